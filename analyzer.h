@@ -0,0 +1,2710 @@
+/* =====================================================
+   PASSWORD ANALYSIS ENGINE
+   Everything needed to analyze a password without the
+   HTTP server: matchers, indexes, estimator, metrics
+   and the result cache. Every definition is inline, so
+   any number of translation units can include it.
+   ===================================================== */
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <cstring>
+#include <string_view>
+#include <thread>
+#include <chrono>
+#include <iomanip>
+#include <array>
+#include <cmath>
+#include <ctime>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define PW_SIMD_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define PW_SIMD_NEON 1
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/* =====================================================
+   FLAT AHO-CORASICK AUTOMATON
+   Nodes live in one contiguous array in breadth-first
+   order, so the children of a node are consecutive and
+   need no edge table: the label of node i is labels[i].
+   Indices are 32-bit, the alphabet is the full byte
+   range, and the same layout is used in memory and in
+   the on-disk dictionary image.
+   ===================================================== */
+
+const uint32_t NO_NODE = 0xffffffffu;
+
+// 16 bytes per node, plus one label byte.
+struct AutomatonNode {
+    uint32_t firstChild;
+    uint32_t fail;      // longest proper suffix that is also a trie path
+    uint32_t output;    // nearest word end along the fail chain, or NO_NODE
+    uint16_t childCount;
+    uint8_t depth;
+    uint8_t isEnd;
+};
+
+struct PatternMatch {
+    int patternId;
+    size_t start;
+    size_t length;
+};
+
+// Non-owning view over a node array; see Trie and DictionaryIndex for owners.
+class Automaton {
+private:
+    const AutomatonNode* nodes = nullptr;
+    const uint8_t* labels = nullptr;
+    uint32_t count = 0;
+    uint32_t rootNext[256];     // the root is hit on most steps, so it gets a direct table
+
+    // Children are sorted by label, so a binary search finds the edge.
+    uint32_t child(uint32_t node, uint8_t c) const {
+        if (node == 0) return rootNext[c];
+        const AutomatonNode& n = nodes[node];
+        if (n.firstChild > count || n.childCount > count - n.firstChild) return NO_NODE;    // corrupt mapping
+        uint32_t lo = n.firstChild, hi = n.firstChild + n.childCount;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (labels[mid] < c) lo = mid + 1;
+            else hi = mid;
+        }
+        return (lo < n.firstChild + n.childCount && labels[lo] == c) ? lo : NO_NODE;
+    }
+
+public:
+    Automaton() { fill(rootNext, rootNext + 256, NO_NODE); }
+
+    void reset(const AutomatonNode* n, const uint8_t* l, uint32_t nodeCount) {
+        nodes = n;
+        labels = l;
+        count = nodeCount;
+        fill(rootNext, rootNext + 256, NO_NODE);
+        if (!count) return;
+        for (uint32_t i = 0; i < nodes[0].childCount && nodes[0].firstChild + i < count; i++)
+            rootNext[labels[nodes[0].firstChild + i]] = nodes[0].firstChild + i;
+    }
+
+    // A fail or output link that a scan may follow: in the array and strictly shallower.
+    bool shorterSuffix(uint32_t from, uint32_t to) const {
+        return to < count && nodes[to].depth < nodes[from].depth;
+    }
+
+    uint32_t nodeCount() const { return count; }
+    const AutomatonNode& node(uint32_t i) const { return nodes[i]; }
+
+    // Node reached by spelling word from the root, or NO_NODE.
+    uint32_t find(string_view word) const {
+        if (!count) return NO_NODE;
+        uint32_t curr = 0;
+        for (char c : word) {
+            curr = child(curr, (uint8_t)c);
+            if (curr == NO_NODE) break;
+        }
+        return curr;
+    }
+
+    bool contains(string_view word) const {
+        uint32_t n = find(word);
+        return n != NO_NODE && nodes[n].isEnd;
+    }
+
+    /* Calls onMatch(node, start, length) for every word occurrence in text.
+       Mapped nodes aren't validated when a file opens, so links are only
+       followed to shallower nodes inside the array; that keeps a corrupt
+       file's scan in bounds and finite, and costs a compare per link. */
+    template <typename F>
+    void scan(string_view text, F&& onMatch) const {
+        if (!count) return;
+        uint32_t curr = 0;
+        for (size_t i = 0; i < text.length(); i++) {
+            uint8_t c = (uint8_t)text[i];
+            uint32_t next;
+            while ((next = child(curr, c)) == NO_NODE && curr != 0)
+                curr = shorterSuffix(curr, nodes[curr].fail) ? nodes[curr].fail : 0;
+            curr = next == NO_NODE ? 0 : next;
+            uint32_t out = nodes[curr].isEnd ? curr : shorterSuffix(curr, nodes[curr].output) ? nodes[curr].output : NO_NODE;
+            while (out != NO_NODE) {
+                if (nodes[out].depth <= i + 1) onMatch(out, i + 1 - nodes[out].depth, (size_t)nodes[out].depth);
+                out = shorterSuffix(out, nodes[out].output) ? nodes[out].output : NO_NODE;
+            }
+        }
+    }
+};
+
+/* A word with its first eight bytes cached as a big-endian, zero-padded
+   key. Keys order like the words themselves, so sorting large lists
+   mostly compares integers instead of chasing two pointers into memcmp. */
+struct SortableWord {
+    uint64_t key;
+    string_view word;
+    int id;
+
+    SortableWord(string_view w, int wordId) : key(0), word(w), id(wordId) {
+        for (size_t i = 0; i < 8; i++) key = (key << 8) | (i < w.size() ? (uint8_t)w[i] : 0);
+    }
+
+    bool operator<(const SortableWord& o) const {
+        if (key != o.key) return key < o.key;
+        int c = word.compare(o.word);
+        return c != 0 ? c < 0 : id < o.id;
+    }
+};
+
+inline void sortUniqueWords(vector<string_view>& words) {
+    vector<SortableWord> sorted;
+    sorted.reserve(words.size());
+    for (string_view w : words) sorted.emplace_back(w, 0);
+    sort(sorted.begin(), sorted.end());
+    words.clear();
+    for (const SortableWord& s : sorted)
+        if (words.empty() || words.back() != s.word) words.push_back(s.word);
+}
+
+/* Builds the flat layout from sorted, unique words of at most 255 bytes.
+   Each new word shares a prefix with the previous one, so it only ever
+   appends children after the last existing child of a node; a
+   breadth-first pass then renumbers the nodes and fills in the
+   failure links. */
+inline bool compileAutomaton(const vector<string_view>& words,
+                      vector<AutomatonNode>& nodes, vector<uint8_t>& labels) {
+    struct BuildNode { uint32_t firstChild, nextSibling, lastChild; uint8_t label, depth, isEnd; };
+    vector<BuildNode> build(1, BuildNode{NO_NODE, NO_NODE, NO_NODE, 0, 0, 0});
+    vector<uint32_t> path(1, 0);
+    string_view prev;
+    for (string_view w : words) {
+        size_t common = 0;
+        while (common < w.size() && common < prev.size() && w[common] == prev[common]) common++;
+        path.resize(common + 1);
+        if (build.size() + w.size() >= NO_NODE) return false;
+        for (size_t j = common; j < w.size(); j++) {
+            uint32_t id = (uint32_t)build.size();
+            uint32_t parent = path.back();
+            build.push_back(BuildNode{NO_NODE, NO_NODE, NO_NODE, (uint8_t)w[j], (uint8_t)(j + 1), 0});
+            if (build[parent].lastChild == NO_NODE) build[parent].firstChild = id;
+            else build[build[parent].lastChild].nextSibling = id;
+            build[parent].lastChild = id;
+            path.push_back(id);
+        }
+        build[path.back()].isEnd = 1;
+        prev = w;
+    }
+
+    // order[k] is the build node that becomes node k.
+    size_t n = build.size();
+    vector<uint32_t> order;
+    order.reserve(n);
+    order.push_back(0);
+    vector<uint32_t> parentOf(n, 0);
+    nodes.assign(n, AutomatonNode{});
+    labels.assign(n, 0);
+    for (size_t k = 0; k < n; k++) {
+        const BuildNode& b = build[order[k]];
+        AutomatonNode& node = nodes[k];
+        node.firstChild = (uint32_t)order.size();
+        node.depth = b.depth;
+        node.isEnd = b.isEnd;
+        for (uint32_t c = b.firstChild; c != NO_NODE; c = build[c].nextSibling) {
+            labels[order.size()] = build[c].label;
+            parentOf[order.size()] = (uint32_t)k;
+            order.push_back(c);
+            node.childCount++;
+        }
+    }
+    vector<BuildNode>().swap(build);
+    vector<uint32_t>().swap(order);
+
+    // Most fail chains end at the root, so its children get a direct table here too
+    uint32_t rootNext[256];
+    fill(rootNext, rootNext + 256, NO_NODE);
+    for (uint32_t i = nodes[0].firstChild; i < nodes[0].firstChild + nodes[0].childCount; i++)
+        rootNext[labels[i]] = i;
+    auto childOf = [&](uint32_t node, uint8_t c) -> uint32_t {
+        if (node == 0) return rootNext[c];
+        const AutomatonNode& p = nodes[node];
+        auto first = labels.begin() + p.firstChild, last = first + p.childCount;
+        auto it = lower_bound(first, last, c);
+        return (it != last && *it == c) ? (uint32_t)(it - labels.begin()) : NO_NODE;
+    };
+    nodes[0].fail = 0;
+    nodes[0].output = NO_NODE;
+    for (size_t k = 1; k < n; k++) {
+        uint32_t fail = 0;
+        if (parentOf[k] != 0) {
+            uint32_t f = nodes[parentOf[k]].fail, next;
+            while ((next = childOf(f, labels[k])) == NO_NODE && f != 0) f = nodes[f].fail;
+            if (next != NO_NODE) fail = next;
+        }
+        nodes[k].fail = fail;
+        const AutomatonNode& failNode = nodes[fail];
+        nodes[k].output = failNode.isEnd ? fail : failNode.output;
+    }
+    return true;
+}
+
+/* =====================================================
+   MONOTONIC ARENA
+   Bump-pointer storage for data that lives and dies
+   with one owner, such as the pattern text of an index
+   snapshot: allocation is a pointer increment, and
+   freeing is a handful of block releases no matter how
+   many objects were carved out.
+   ===================================================== */
+
+const size_t ARENA_BLOCK_SIZE = 1 << 20;
+
+class Arena {
+private:
+    vector<unique_ptr<char[]>> blocks;
+    char* cursor = nullptr;
+    size_t left = 0;
+    size_t reserved = 0;
+
+public:
+    Arena() = default;
+    Arena(Arena&&) = default;
+    Arena& operator=(Arena&&) = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t align = alignof(max_align_t)) {
+        size_t pad = (align - (uintptr_t)cursor % align) % align;
+        if (pad + bytes > left) {
+            // Oversized requests get a block of their own, leaving the current one in use
+            size_t size = max(bytes + align, ARENA_BLOCK_SIZE);
+            blocks.emplace_back(new char[size]);
+            reserved += size;
+            char* block = blocks.back().get();
+            if (size != ARENA_BLOCK_SIZE) {
+                size_t offset = (align - (uintptr_t)block % align) % align;
+                return block + offset;
+            }
+            cursor = block;
+            left = size;
+            pad = (align - (uintptr_t)cursor % align) % align;
+        }
+        char* p = cursor + pad;
+        cursor = p + bytes;
+        left -= pad + bytes;
+        return p;
+    }
+
+    string_view copy(string_view s) {
+        char* p = (char*)allocate(s.size(), 1);
+        memcpy(p, s.data(), s.size());
+        return string_view(p, s.size());
+    }
+
+    void release() {
+        blocks.clear();
+        cursor = nullptr;
+        left = reserved = 0;
+    }
+
+    size_t bytesReserved() const { return reserved; }
+};
+
+/* =====================================================
+   TRIE DATA STRUCTURE FOR WEAK PATTERN STORAGE
+   Patterns are collected by insert() and compiled into
+   a flat automaton by build(), after which findAll()
+   reports every pattern in a text in one linear pass.
+   Pending words are copied into an arena, so building
+   makes no per-word allocations and build() frees them
+   all at once.
+   ===================================================== */
+
+class Trie {
+private:
+    Arena pendingText;                      // backs pending, released by build()
+    vector<SortableWord> pending;
+    vector<AutomatonNode> nodes;
+    vector<uint8_t> labels;
+    vector<int> patternIds;     // per node, -1 unless a pattern ends there
+    Automaton automaton;
+    size_t skipped = 0;         // words longer than the automaton's 255-byte limit
+
+public:
+    Trie() = default;
+    Trie(const Trie&) = delete;
+    Trie& operator=(const Trie&) = delete;
+
+    // False if the word was too long to store; skippedWords() counts those.
+    bool insert(string_view word, int patternId = -1) {
+        if (word.length() > 255) { skipped++; return false; }
+        if (!word.empty()) pending.emplace_back(pendingText.copy(word), patternId);
+        return true;
+    }
+
+    size_t skippedWords() const { return skipped; }
+
+    // False if the words overflow the automaton's node limit; the trie then matches nothing.
+    bool build() {
+        sort(pending.begin(), pending.end());
+        vector<string_view> words;
+        for (const SortableWord& p : pending)
+            if (words.empty() || words.back() != p.word) words.push_back(p.word);
+        if (!compileAutomaton(words, nodes, labels)) {
+            nodes.clear();
+            labels.clear();
+            vector<SortableWord>().swap(pending);
+            pendingText.release();
+            return false;
+        }
+        automaton.reset(nodes.data(), labels.data(), (uint32_t)nodes.size());
+        patternIds.assign(nodes.size(), -1);
+        for (const SortableWord& p : pending) {
+            int& id = patternIds[automaton.find(p.word)];
+            if (id < 0) id = p.id;
+        }
+        vector<SortableWord>().swap(pending);
+        pendingText.release();
+        return true;
+    }
+
+    bool search(const string& word) const { return automaton.contains(word); }
+
+    // Calls onMatch(match) for every pattern occurrence; build() must have been called.
+    template <typename F>
+    void scan(string_view text, F&& onMatch) const {
+        automaton.scan(text, [&](uint32_t node, size_t start, size_t length) {
+            onMatch(PatternMatch{patternIds[node], start, length});
+        });
+    }
+
+    vector<PatternMatch> findAll(string_view text) const {
+        vector<PatternMatch> matches;
+        scan(text, [&](const PatternMatch& m) { matches.push_back(m); });
+        return matches;
+    }
+};
+
+/* =====================================================
+   COMPILE-TIME AUTOMATON FOR FIXED WORD LISTS
+   A word list known at build time is compiled by the
+   compiler into a dense Aho-Corasick DFA: one table
+   row per trie node, one column per byte class (each
+   byte that occurs in a word, plus one for the rest).
+   The tables are constexpr, so they sit in .rodata
+   with no construction at startup, and a scan step is
+   a single table load. scan() matches Trie::scan, so
+   either can serve one call site.
+   ===================================================== */
+
+constexpr size_t staticLength(const char* s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+// Trie nodes (root included) for a word list: 1 + the distinct non-empty prefixes.
+template <size_t N>
+constexpr size_t staticStateCount(const char* const (&words)[N]) {
+    size_t states = 1;
+    for (size_t i = 0; i < N; i++) {
+        size_t length = staticLength(words[i]), shared = 0;
+        for (size_t j = 0; j < i; j++) {
+            size_t k = 0;
+            while (k < length && words[i][k] && words[i][k] == words[j][k]) k++;
+            shared = max(shared, k);
+        }
+        states += length - shared;
+    }
+    return states;
+}
+
+// Distinct bytes in a word list, plus one class for every other byte.
+template <size_t N>
+constexpr size_t staticClassCount(const char* const (&words)[N]) {
+    bool seen[256] = {};
+    size_t classes = 1;
+    for (size_t i = 0; i < N; i++)
+        for (const char* p = words[i]; *p; p++)
+            if (!seen[(uint8_t)*p]) { seen[(uint8_t)*p] = true; classes++; }
+    return classes;
+}
+
+template <const auto& Words>
+class StaticAutomaton {
+private:
+    static constexpr size_t WORDS = sizeof(Words) / sizeof(Words[0]);
+    static constexpr size_t STATES = staticStateCount(Words);
+    static constexpr size_t CLASSES = staticClassCount(Words);
+    using State = conditional_t<(STATES < 256), uint8_t, uint16_t>;
+    static constexpr State NONE = (State)STATES;
+    static_assert(STATES < 65536 && WORDS < 32768, "word list too large for a static automaton");
+    static_assert(CLASSES <= 256, "byte classes must fit the uint8_t class ids");
+
+    uint8_t classOf[256];
+    State next[STATES][CLASSES];
+    State output[STATES];       // nearest word end along the fail chain, or NONE
+    int16_t wordId[STATES];     // first word ending at the state, or -1
+    uint8_t depth[STATES];
+
+public:
+    constexpr StaticAutomaton() : classOf(), next(), output(), wordId(), depth() {
+        uint8_t classes = 1;
+        for (size_t w = 0; w < WORDS; w++)
+            for (const char* p = Words[w]; *p; p++)
+                if (!classOf[(uint8_t)*p]) classOf[(uint8_t)*p] = classes++;
+
+        for (size_t s = 0; s < STATES; s++) {
+            for (size_t c = 0; c < CLASSES; c++) next[s][c] = NONE;
+            wordId[s] = -1;
+        }
+        size_t used = 1;
+        for (size_t w = 0; w < WORDS; w++) {
+            size_t s = 0;
+            for (const char* p = Words[w]; *p; p++) {
+                State& edge = next[s][classOf[(uint8_t)*p]];
+                if (edge == NONE) {
+                    edge = (State)used++;
+                    depth[edge] = (uint8_t)(depth[s] + 1);
+                }
+                s = edge;
+            }
+            if (s && wordId[s] < 0) wordId[s] = (int16_t)w;
+        }
+
+        // Breadth-first: a node's fail target is shallower, so its row is already complete.
+        State fail[STATES] = {}, queue[STATES] = {};
+        size_t head = 0, tail = 0;
+        output[0] = NONE;
+        for (size_t c = 0; c < CLASSES; c++) {
+            State child = next[0][c];
+            if (child == NONE) next[0][c] = 0;
+            else { fail[child] = 0; queue[tail++] = child; }
+        }
+        while (head < tail) {
+            State s = queue[head++];
+            State f = fail[s];
+            output[s] = wordId[f] >= 0 ? f : output[f];
+            for (size_t c = 0; c < CLASSES; c++) {
+                State child = next[s][c];
+                if (child == NONE) next[s][c] = next[f][c];
+                else { fail[child] = next[f][c]; queue[tail++] = child; }
+            }
+        }
+    }
+
+    // Calls onMatch(match) for every word occurrence in text, like Trie::scan.
+    template <typename F>
+    void scan(string_view text, F&& onMatch) const {
+        State s = 0;
+        for (size_t i = 0; i < text.length(); i++) {
+            s = next[s][classOf[(uint8_t)text[i]]];
+            for (State out = wordId[s] >= 0 ? s : output[s]; out != NONE; out = output[out])
+                onMatch(PatternMatch{wordId[out], i + 1 - depth[out], (size_t)depth[out]});
+        }
+    }
+};
+
+/* =====================================================
+   BLOCKED BLOOM FILTER
+   Each key sets BLOOM_PROBES bits inside one 64-byte
+   block chosen by its hash, so a lookup reads a single
+   cache line. At BLOOM_BITS_PER_KEY bits per key about
+   1% of misses get through to the exact lookup.
+   ===================================================== */
+
+const size_t BLOOM_BLOCK_BITS = 512;
+const int BLOOM_PROBES = 7;                 // 9 bits each from one 64-bit hash
+const size_t BLOOM_BITS_PER_KEY = 12;
+
+struct BloomBlock {
+    uint64_t words[BLOOM_BLOCK_BITS / 64];
+};
+
+// FNV-1a with a splitmix64 finalizer, so both halves are well mixed.
+inline uint64_t hashKey(string_view key) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : key) h = (h ^ (uint8_t)c) * 0x100000001b3ull;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+// Non-owning view over the block array; an empty filter lets everything through.
+class BloomFilter {
+private:
+    const BloomBlock* blocks = nullptr;
+    uint64_t count = 0;
+
+    static uint64_t blockFor(uint64_t h, uint64_t blockCount) { return ((h >> 32) * blockCount) >> 32; }
+
+    // Probe bits come from a remix of the hash so they are independent of the block choice.
+    static uint64_t probesFor(uint64_t h) { return h * 0x9e3779b97f4a7c15ull; }
+
+public:
+    static uint64_t blocksFor(size_t keys) {
+        return max<uint64_t>(1, (keys * BLOOM_BITS_PER_KEY + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS);
+    }
+
+    static void add(BloomBlock* blocks, uint64_t blockCount, string_view key) {
+        uint64_t h = hashKey(key);
+        BloomBlock& block = blocks[blockFor(h, blockCount)];
+        uint64_t probes = probesFor(h);
+        for (int i = 0; i < BLOOM_PROBES; i++) {
+            uint32_t bit = (uint32_t)(probes >> (9 * i)) & (BLOOM_BLOCK_BITS - 1);
+            block.words[bit / 64] |= 1ull << (bit % 64);
+        }
+    }
+
+    void reset(const BloomBlock* b, uint64_t blockCount) {
+        blocks = b;
+        count = blockCount;
+    }
+
+    bool mayContain(string_view key) const {
+        if (!count) return true;
+        uint64_t h = hashKey(key);
+        const BloomBlock& block = blocks[blockFor(h, count)];
+        uint64_t probes = probesFor(h);
+        for (int i = 0; i < BLOOM_PROBES; i++) {
+            uint32_t bit = (uint32_t)(probes >> (9 * i)) & (BLOOM_BLOCK_BITS - 1);
+            if (!(block.words[bit / 64] & (1ull << (bit % 64)))) return false;
+        }
+        return true;
+    }
+};
+
+/* =====================================================
+   PREBUILT DICTIONARY INDEX (MEMORY-MAPPED)
+   `backend --build-index` writes a header followed by the
+   flat automaton and a Bloom filter over the same words.
+   The server maps the file read-only, so startup does no
+   parsing and processes share the page cache.
+   ===================================================== */
+
+const char INDEX_MAGIC[8] = {'P', 'W', 'I', 'D', 'X', 0, 0, 0};
+const uint32_t INDEX_VERSION = 2;
+const size_t INDEX_BLOOM_ALIGN = 64;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t wordCount;
+    uint32_t reserved;
+    uint64_t nodesOffset;
+    uint64_t labelsOffset;
+    uint64_t fileSize;
+    uint64_t bloomOffset;       // INDEX_BLOOM_ALIGN-aligned
+    uint64_t bloomBlocks;
+};
+
+class MappedFile {
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+        if (data_) munmap((void*)data_, size_);
+#endif
+    }
+
+    bool open(const string& path) {
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) return false;
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_) return false;
+        data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        size_ = (size_t)size.QuadPart;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        data_ = (const char*)p;
+        size_ = (size_t)st.st_size;
+#endif
+        return data_ != nullptr;
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+};
+
+class DictionaryIndex {
+private:
+    MappedFile file;
+    const IndexHeader* header = nullptr;
+    Automaton automaton;
+    BloomFilter bloom;
+
+public:
+    bool open(const string& path, string& error) {
+        if (!file.open(path)) { error = "cannot map " + path; return false; }
+        if (file.size() < sizeof(IndexHeader)) { error = "truncated index"; return false; }
+        header = (const IndexHeader*)file.data();
+        if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+            header->version != INDEX_VERSION) {
+            error = "not a version " + to_string(INDEX_VERSION) + " index (rebuild with --build-index)";
+            return false;
+        }
+        if (header->fileSize != file.size() || header->nodeCount == 0 ||
+            header->nodesOffset % alignof(AutomatonNode) != 0 ||
+            header->nodesOffset + (uint64_t)header->nodeCount * sizeof(AutomatonNode) > file.size() ||
+            header->labelsOffset + header->nodeCount > file.size() ||
+            header->bloomOffset % INDEX_BLOOM_ALIGN != 0 ||
+            header->bloomBlocks > (file.size() - min<uint64_t>(header->bloomOffset, file.size())) / sizeof(BloomBlock)) {
+            error = "corrupt index";
+            return false;
+        }
+        automaton.reset((const AutomatonNode*)(file.data() + header->nodesOffset),
+                        (const uint8_t*)(file.data() + header->labelsOffset), header->nodeCount);
+        bloom.reset((const BloomBlock*)(file.data() + header->bloomOffset), header->bloomBlocks);
+        return true;
+    }
+
+    uint32_t wordCount() const { return header->wordCount; }
+    uint32_t nodeCount() const { return header->nodeCount; }
+
+    /* Exact lookup of a whole (already lowercased) word. Most
+       lookups miss, and the filter answers those from one
+       cache line instead of a walk through the automaton. */
+    bool contains(string_view word) const { return bloom.mayContain(word) && automaton.contains(word); }
+
+    // Calls onMatch(match) for every dictionary word in text; patternId is -1 for these.
+    template <typename F>
+    void scan(string_view text, F&& onMatch) const {
+        automaton.scan(text, [&](uint32_t, size_t start, size_t length) {
+            onMatch(PatternMatch{-1, start, length});
+        });
+    }
+};
+
+/* =====================================================
+   DICTIONARY INDEX BUILDER
+   ===================================================== */
+
+inline int buildIndexCommand(const string& wordlistPath, const string& outPath, size_t minLength) {
+    ifstream in(wordlistPath, ios::binary);
+    if (!in) { cerr << "Cannot open " << wordlistPath << "\n"; return 1; }
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    for (char& c : text) c = (char)tolower((unsigned char)c);
+
+    vector<string_view> words;
+    size_t tooLong = 0;
+    for (size_t pos = 0; pos < text.size();) {
+        size_t end = text.find('\n', pos);
+        if (end == string::npos) end = text.size();
+        size_t len = end - pos;
+        if (len > 0 && text[pos + len - 1] == '\r') len--;
+        if (len > 255) tooLong++;
+        else if (len >= minLength) words.emplace_back(text.data() + pos, len);
+        pos = end + 1;
+    }
+    if (tooLong) cerr << "Skipped " << tooLong << " words longer than 255 bytes\n";
+    sortUniqueWords(words);
+
+    vector<AutomatonNode> nodes;
+    vector<uint8_t> labels;
+    if (!compileAutomaton(words, nodes, labels)) { cerr << "Wordlist too large\n"; return 1; }
+    size_t n = nodes.size();
+
+    IndexHeader header = {};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.nodeCount = (uint32_t)n;
+    header.wordCount = (uint32_t)words.size();
+    header.nodesOffset = sizeof(IndexHeader);
+    header.labelsOffset = header.nodesOffset + n * sizeof(AutomatonNode);
+    header.bloomOffset = (header.labelsOffset + n + INDEX_BLOOM_ALIGN - 1) / INDEX_BLOOM_ALIGN * INDEX_BLOOM_ALIGN;
+    header.bloomBlocks = BloomFilter::blocksFor(words.size());
+    header.fileSize = header.bloomOffset + header.bloomBlocks * sizeof(BloomBlock);
+
+    vector<BloomBlock> bloom(header.bloomBlocks, BloomBlock{});
+    for (string_view w : words) BloomFilter::add(bloom.data(), bloom.size(), w);
+
+    ofstream out(outPath, ios::binary | ios::trunc);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)nodes.data(), n * sizeof(AutomatonNode));
+    out.write((const char*)labels.data(), n);
+    static const char padding[INDEX_BLOOM_ALIGN] = {};
+    out.write(padding, header.bloomOffset - (header.labelsOffset + n));
+    out.write((const char*)bloom.data(), bloom.size() * sizeof(BloomBlock));
+    if (!out) { cerr << "Cannot write " << outPath << "\n"; return 1; }
+
+    cout << "Indexed " << words.size() << " words into " << n << " nodes ("
+         << header.fileSize / (1024 * 1024) << " MB)\n";
+    return 0;
+}
+
+/* =====================================================
+   SHA-1
+   Only used to key the k-anonymity range table, which
+   follows the Pwned Passwords API and so has to use
+   SHA-1; it is not used for anything security-relevant.
+   ===================================================== */
+
+struct Sha1Digest {
+    uint8_t bytes[20];
+};
+
+inline uint32_t rotl32(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+inline void sha1Block(uint32_t h[5], const uint8_t* p) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 80; i++) w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) { f = (b & c) | (~b & d); k = 0x5a827999; }
+        else if (i < 40) { f = b ^ c ^ d; k = 0x6ed9eba1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+        else { f = b ^ c ^ d; k = 0xca62c1d6; }
+        uint32_t t = rotl32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl32(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+inline Sha1Digest sha1(string_view data) {
+    uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    const uint8_t* p = (const uint8_t*)data.data();
+    size_t full = data.size() / 64 * 64;
+    for (size_t i = 0; i < full; i += 64) sha1Block(h, p + i);
+
+    // Padding: 0x80, zeros, then the bit length big-endian in the last 8 bytes
+    uint8_t tail[128] = {};
+    size_t rest = data.size() - full;
+    memcpy(tail, p + full, rest);
+    tail[rest] = 0x80;
+    size_t tailSize = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)data.size() * 8;
+    for (int i = 0; i < 8; i++) tail[tailSize - 1 - i] = (uint8_t)(bits >> (8 * i));
+    for (size_t i = 0; i < tailSize; i += 64) sha1Block(h, tail + i);
+
+    Sha1Digest digest;
+    for (int i = 0; i < 20; i++) digest.bytes[i] = (uint8_t)(h[i / 4] >> (24 - 8 * (i % 4)));
+    return digest;
+}
+
+/* =====================================================
+   CONSISTENT HASH RING
+   Splits the range table's prefixes between shards so
+   that a corpus too large for one node can be spread
+   over several. Every shard name gets RING_POINTS_PER_SHARD
+   points on a 64-bit ring and a prefix belongs to the
+   first point at or after its own hash, so adding or
+   removing a shard only moves the prefixes next to its
+   points, and nodes given the same names agree on every
+   owner without talking to each other.
+   ===================================================== */
+
+const size_t RING_POINTS_PER_SHARD = 128;
+
+inline uint32_t rangePrefix(const uint8_t* hash) {
+    return (uint32_t)hash[0] << 12 | (uint32_t)hash[1] << 4 | hash[2] >> 4;
+}
+
+class HashRing {
+private:
+    vector<string> names;                       // sorted, so the order given doesn't matter
+    vector<pair<uint64_t, uint32_t>> points;    // ring position and index into names, sorted
+
+public:
+    // Comma-separated shard names; false if there are none or one repeats.
+    bool parse(string_view spec, string& error) {
+        names.clear();
+        points.clear();
+        for (size_t pos = 0; pos <= spec.size();) {
+            size_t end = min(spec.find(',', pos), spec.size());
+            string_view name = spec.substr(pos, end - pos);
+            while (!name.empty() && name.front() == ' ') name.remove_prefix(1);
+            while (!name.empty() && name.back() == ' ') name.remove_suffix(1);
+            if (!name.empty()) names.emplace_back(name);
+            pos = end + 1;
+        }
+        sort(names.begin(), names.end());
+        if (names.empty()) { error = "no shards in ring"; return false; }
+        if (adjacent_find(names.begin(), names.end()) != names.end()) { error = "shard names repeat in ring"; return false; }
+        for (uint32_t i = 0; i < names.size(); i++)
+            for (size_t p = 0; p < RING_POINTS_PER_SHARD; p++)
+                points.emplace_back(hashKey(names[i] + "#" + to_string(p)), i);
+        sort(points.begin(), points.end());
+        return true;
+    }
+
+    size_t size() const { return names.size(); }
+    const string& name(size_t shard) const { return names[shard]; }
+
+    // Index of the named shard, or -1.
+    int find(string_view name) const {
+        auto it = lower_bound(names.begin(), names.end(), name);
+        return it != names.end() && *it == name ? (int)(it - names.begin()) : -1;
+    }
+
+    size_t ownerOf(uint32_t prefix) const {
+        uint8_t key[4] = {(uint8_t)prefix, (uint8_t)(prefix >> 8), (uint8_t)(prefix >> 16), 0};
+        uint64_t h = hashKey(string_view((const char*)key, sizeof(key)));
+        auto it = lower_bound(points.begin(), points.end(), make_pair(h, 0u));
+        return (it == points.end() ? points.front() : *it).second;
+    }
+
+    // Identifies a shard of this ring in its range table; never 0, which marks a whole table.
+    uint32_t shardId(size_t shard) const {
+        string key = names[shard] + "@";
+        for (const string& n : names) key += n + ",";
+        return (uint32_t)hashKey(key) | 1;
+    }
+};
+
+/* =====================================================
+   K-ANONYMITY RANGE TABLE (MEMORY-MAPPED)
+   Breached-password SHA-1 hashes grouped by their first
+   five hex digits. The file holds a header, an offset
+   per prefix, and the response text itself ("SUFFIX:COUNT"
+   lines, sorted), so /range/{prefix} hands a slice of the
+   mapping straight to the socket without copying it.
+   ===================================================== */
+
+const char RANGE_MAGIC[8] = {'P', 'W', 'R', 'N', 'G', 0, 0, 0};
+const uint32_t RANGE_VERSION = 1;
+const size_t RANGE_PREFIX_DIGITS = 5;
+const uint32_t RANGE_PREFIXES = 1u << (4 * RANGE_PREFIX_DIGITS);
+const size_t RANGE_SUFFIX_DIGITS = 40 - RANGE_PREFIX_DIGITS;
+const char RANGE_HEX[] = "0123456789ABCDEF";
+inline const char* RANGE_CACHE_CONTROL = "public, max-age=86400";   // ranges only change on reload
+
+struct RangeHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t shardId;           // HashRing::shardId of the shard it was built for; 0 for the whole table
+    uint64_t hashCount;
+    uint64_t buildId;           // hash of the contents, used as the ETag
+    uint64_t offsetsOffset;     // RANGE_PREFIXES + 1 offsets into the text
+    uint64_t textOffset;
+    uint64_t fileSize;
+};
+
+class RangeTable {
+private:
+    MappedFile file;
+    const RangeHeader* header = nullptr;
+    const uint64_t* offsets = nullptr;
+    const char* text = nullptr;
+
+public:
+    bool open(const string& path, string& error) {
+        if (!file.open(path)) { error = "cannot map " + path; return false; }
+        if (file.size() < sizeof(RangeHeader)) { error = "truncated range table"; return false; }
+        header = (const RangeHeader*)file.data();
+        if (memcmp(header->magic, RANGE_MAGIC, sizeof(RANGE_MAGIC)) != 0 || header->version != RANGE_VERSION) {
+            error = "not a version " + to_string(RANGE_VERSION) + " range table";
+            return false;
+        }
+        uint64_t offsetsSize = (uint64_t)(RANGE_PREFIXES + 1) * sizeof(uint64_t);
+        if (header->fileSize != file.size() || header->offsetsOffset % sizeof(uint64_t) != 0 ||
+            header->offsetsOffset + offsetsSize > file.size() || header->textOffset > file.size()) {
+            error = "corrupt range table";
+            return false;
+        }
+        offsets = (const uint64_t*)(file.data() + header->offsetsOffset);
+        text = file.data() + header->textOffset;
+        uint64_t textSize = file.size() - header->textOffset;
+        for (uint32_t i = 0; i < RANGE_PREFIXES; i++)
+            if (offsets[i] > offsets[i + 1]) { error = "corrupt range table"; return false; }
+        if (offsets[0] != 0 || offsets[RANGE_PREFIXES] != textSize) { error = "corrupt range table"; return false; }
+        return true;
+    }
+
+    uint64_t hashCount() const { return header->hashCount; }
+    uint64_t buildId() const { return header->buildId; }
+    uint32_t shardId() const { return header->shardId; }
+
+    // Response body for a prefix below RANGE_PREFIXES; points into the mapping.
+    string_view range(uint32_t prefix) const {
+        return string_view(text + offsets[prefix], offsets[prefix + 1] - offsets[prefix]);
+    }
+
+    // Times the hash was seen, or 0; a binary search over its prefix's sorted lines.
+    uint32_t count(const Sha1Digest& digest) const {
+        char suffix[RANGE_SUFFIX_DIGITS];
+        for (size_t d = 0; d < RANGE_SUFFIX_DIGITS; d++) {
+            size_t digit = RANGE_PREFIX_DIGITS + d;
+            suffix[d] = RANGE_HEX[(digest.bytes[digit / 2] >> (digit % 2 ? 0 : 4)) & 0xf];
+        }
+        string_view lines = range(rangePrefix(digest.bytes));
+        size_t lo = 0, hi = lines.size();       // lo is always the start of a line
+        while (lo < hi) {
+            size_t line = lo + (hi - lo) / 2;
+            while (line > lo && lines[line - 1] != '\n') line--;
+            if (lines.size() - line <= RANGE_SUFFIX_DIGITS) return 0;
+            int order = memcmp(lines.data() + line, suffix, RANGE_SUFFIX_DIGITS);
+            if (order == 0) return (uint32_t)strtoul(lines.data() + line + RANGE_SUFFIX_DIGITS + 1, nullptr, 10);
+            if (order > 0) { hi = line; continue; }
+            size_t end = lines.find('\n', line);
+            lo = end == string_view::npos ? hi : end + 1;
+        }
+        return 0;
+    }
+};
+
+/* =====================================================
+   RANGE TABLE BUILDER
+   Input lines are either plaintext passwords or already
+   hashed "SHA1HEX[:COUNT]" lines as published by Pwned
+   Passwords; duplicates are merged and their counts
+   summed.
+   ===================================================== */
+
+struct RangeEntry {
+    uint8_t hash[20];
+    uint32_t count;
+};
+
+inline int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// The 20 bytes spelled by the first 40 hex digits of text, in either case.
+inline bool parseSha1Hex(string_view text, uint8_t* hash) {
+    if (text.size() < 40) return false;
+    for (int i = 0; i < 20; i++) {
+        int hi = hexValue(text[2 * i]), lo = hexValue(text[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        hash[i] = (uint8_t)(hi << 4 | lo);
+    }
+    return true;
+}
+
+inline bool parseHashedLine(const string& line, RangeEntry& entry) {
+    if (line.size() > 40 && line[40] != ':') return false;
+    if (!parseSha1Hex(line, entry.hash)) return false;
+    entry.count = line.size() > 41 ? (uint32_t)min<unsigned long long>(strtoull(line.c_str() + 41, nullptr, 10), UINT32_MAX) : 1;
+    return true;
+}
+
+// With a ring, only the hashes whose prefix belongs to shard are kept.
+inline int buildRangeCommand(const string& listPath, const string& outPath, const HashRing* ring = nullptr, size_t shard = 0) {
+    ifstream in(listPath, ios::binary);
+    if (!in) { cerr << "Cannot open " << listPath << "\n"; return 1; }
+    vector<RangeEntry> entries;
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        RangeEntry entry;
+        if (!parseHashedLine(line, entry)) {
+            Sha1Digest digest = sha1(line);
+            memcpy(entry.hash, digest.bytes, sizeof(entry.hash));
+            entry.count = 1;
+        }
+        if (ring && ring->ownerOf(rangePrefix(entry.hash)) != shard) continue;
+        entries.push_back(entry);
+    }
+    auto hashLess = [](const RangeEntry& a, const RangeEntry& b) { return memcmp(a.hash, b.hash, 20) < 0; };
+    sort(entries.begin(), entries.end(), hashLess);
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (kept && memcmp(entries[kept - 1].hash, entries[i].hash, 20) == 0)
+            entries[kept - 1].count = (uint32_t)min<uint64_t>((uint64_t)entries[kept - 1].count + entries[i].count, UINT32_MAX);
+        else
+            entries[kept++] = entries[i];
+    }
+    entries.resize(kept);
+
+    vector<uint64_t> offsets(RANGE_PREFIXES + 1, 0);
+    string text;
+    size_t next = 0;
+    for (uint32_t prefix = 0; prefix < RANGE_PREFIXES; prefix++) {
+        offsets[prefix] = text.size();
+        for (; next < entries.size(); next++) {
+            const uint8_t* h = entries[next].hash;
+            if (rangePrefix(h) != prefix) break;
+            for (size_t d = RANGE_PREFIX_DIGITS; d < 40; d++) text += RANGE_HEX[(h[d / 2] >> (d % 2 ? 0 : 4)) & 0xf];
+            text += ':';
+            text += to_string(entries[next].count);
+            text += "\r\n";
+        }
+    }
+    offsets[RANGE_PREFIXES] = text.size();
+
+    RangeHeader header = {};
+    memcpy(header.magic, RANGE_MAGIC, sizeof(RANGE_MAGIC));
+    header.version = RANGE_VERSION;
+    header.shardId = ring ? ring->shardId(shard) : 0;
+    header.hashCount = entries.size();
+    header.buildId = hashKey(text);
+    header.offsetsOffset = sizeof(RangeHeader);
+    header.textOffset = header.offsetsOffset + offsets.size() * sizeof(uint64_t);
+    header.fileSize = header.textOffset + text.size();
+
+    ofstream out(outPath, ios::binary | ios::trunc);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+    out.write(text.data(), text.size());
+    if (!out) { cerr << "Cannot write " << outPath << "\n"; return 1; }
+
+    cout << "Wrote " << entries.size() << " hashes (" << header.fileSize / (1024 * 1024) << " MB)";
+    if (ring) cout << " for shard " << ring->name(shard) << " of " << ring->size();
+    cout << "\n";
+    return 0;
+}
+
+/* =====================================================
+   BRUTE FORCE STRING MATCHING
+   ===================================================== */
+inline bool bruteForceMatch(const string& text, const string& pattern) {
+    size_t n = text.length();
+    size_t m = pattern.length();
+    for (size_t i = 0; i + m <= n; i++) {
+        size_t j = 0;
+        while (j < m && text[i + j] == pattern[j]) j++;
+        if (j == m) return true;
+    }
+    return false;
+}
+
+/* =====================================================
+   KMP STRING MATCHING
+   ===================================================== */
+inline vector<size_t> computeLPS(const string& pattern) {
+    size_t m = pattern.length();
+    vector<size_t> lps(m, 0);
+    for (size_t i = 1, len = 0; i < m;) {
+        if (pattern[i] == pattern[len]) lps[i++] = ++len;
+        else if (len != 0) len = lps[len - 1];
+        else lps[i++] = 0;
+    }
+    return lps;
+}
+
+inline bool KMPMatch(const string& text, const string& pattern) {
+    vector<size_t> lps = computeLPS(pattern);
+    size_t i = 0, j = 0;
+    while (i < text.length()) {
+        if (text[i] == pattern[j]) { i++; j++; }
+        if (j == pattern.length()) return true;
+        else if (i < text.length() && text[i] != pattern[j]) {
+            if (j != 0) j = lps[j - 1];
+            else i++;
+        }
+    }
+    return false;
+}
+
+/* =====================================================
+   COMPILED SINGLE PATTERNS
+   A pattern compiled once when the index loads, with its
+   KMP prefix table and Horspool skip table precomputed.
+   find() picks the method by pattern length: very short
+   patterns gain nothing over brute force, mid-length
+   ones use KMP, and long ones skip ahead with Horspool.
+   ===================================================== */
+
+const size_t MAX_BRUTE_FORCE_PATTERN = 3;
+const size_t MIN_HORSPOOL_PATTERN = 8;
+
+enum class MatchMethod : uint8_t { BruteForce, Kmp, Horspool };
+
+class CompiledPattern {
+private:
+    string pattern;
+    MatchMethod method_;
+    vector<size_t> lps;
+    size_t skip[256];
+
+    size_t findBruteForce(string_view text, size_t from) const {
+        size_t m = pattern.length();
+        for (size_t i = from; i + m <= text.length(); i++) {
+            size_t j = 0;
+            while (j < m && text[i + j] == pattern[j]) j++;
+            if (j == m) return i;
+        }
+        return string::npos;
+    }
+
+    size_t findKmp(string_view text, size_t from) const {
+        size_t m = pattern.length();
+        size_t j = 0;
+        for (size_t i = from; i < text.length(); i++) {
+            while (j > 0 && text[i] != pattern[j]) j = lps[j - 1];
+            if (text[i] == pattern[j]) j++;
+            if (j == m) return i + 1 - m;
+        }
+        return string::npos;
+    }
+
+    size_t findHorspool(string_view text, size_t from) const {
+        size_t m = pattern.length();
+        for (size_t i = from; i + m <= text.length();) {
+            size_t j = m;
+            while (j > 0 && text[i + j - 1] == pattern[j - 1]) j--;
+            if (j == 0) return i;
+            i += skip[(uint8_t)text[i + m - 1]];
+        }
+        return string::npos;
+    }
+
+public:
+    explicit CompiledPattern(string p) : pattern(move(p)) {
+        size_t m = pattern.length();
+        if (m <= MAX_BRUTE_FORCE_PATTERN) method_ = MatchMethod::BruteForce;
+        else if (m < MIN_HORSPOOL_PATTERN) method_ = MatchMethod::Kmp;
+        else method_ = MatchMethod::Horspool;
+
+        if (method_ == MatchMethod::Kmp) lps = computeLPS(pattern);
+        fill(skip, skip + 256, m);
+        for (size_t i = 0; i + 1 < m; i++) skip[(uint8_t)pattern[i]] = m - 1 - i;
+    }
+
+    const string& text() const { return pattern; }
+    MatchMethod method() const { return method_; }
+
+    // Start of the first occurrence at or after from, or string::npos.
+    size_t find(string_view text, size_t from = 0) const {
+        if (pattern.empty()) return string::npos;
+        switch (method_) {
+        case MatchMethod::BruteForce: return findBruteForce(text, from);
+        case MatchMethod::Kmp: return findKmp(text, from);
+        default: return findHorspool(text, from);
+        }
+    }
+};
+
+/* =====================================================
+   SHARED WEAK PATTERN INDEX
+   Built once at startup and published as an immutable
+   snapshot; request threads only ever read it. A reload
+   builds a fresh snapshot and swaps the pointer, so
+   in-flight requests finish on the old one.
+
+   Readers take no lock and no reference count: each
+   thread announces the epoch it entered in its own
+   slot, then loads the raw pointer. The publisher
+   swaps the pointer, advances the epoch and frees the
+   old snapshot once every slot is idle or has entered
+   a later epoch, so the free happens on the reloading
+   thread rather than on whichever request let go last.
+   ===================================================== */
+
+inline const char* WEAK_PATTERN_FILE = "weak_patterns.txt";
+
+// Which matcher scans the built-in patterns; the dictionary always uses its automaton.
+enum class MatchEngine : uint8_t { AhoCorasick, PerPattern };
+
+inline MatchEngine g_matchEngine = MatchEngine::AhoCorasick;
+
+// Used when weak_patterns.txt is missing; fixed at build time, so it gets a static automaton.
+constexpr const char* DEFAULT_WEAK_PATTERNS[] = {"password", "admin", "qwerty", "1234", "1111"};
+
+constexpr StaticAutomaton<DEFAULT_WEAK_PATTERNS> DEFAULT_WEAK_PATTERN_AUTOMATON;
+
+struct PatternIndex {
+    Arena text;                         // backs patterns; dropping the snapshot frees it in one go
+    vector<string_view> patterns;
+    Trie trie;
+    vector<CompiledPattern> compiled;   // only built for --engine per-pattern; no duplicates
+    vector<int> compiledIds;            // pattern id each compiled entry reports
+    bool defaultPatterns = false;       // patterns are DEFAULT_WEAK_PATTERNS, in order
+    size_t skippedPatterns = 0;         // over 255 bytes, so neither engine ever matches them
+    shared_ptr<const DictionaryIndex> dictionary;   // null when no --index given
+    shared_ptr<const RangeTable> ranges;            // null when no --range given
+    uint64_t generation = 0;                        // bumped on every build; keys the result cache
+};
+
+inline string g_dictionaryPath;
+inline string g_rangePath;
+inline uint32_t g_rangeShardId = 0;    // the shardId the range table must have; 0 for the whole table
+
+// Reads the whole file into the arena and lowercases it in place; patterns point into it.
+inline vector<string_view> loadWeakPatterns(const string& path, Arena& text) {
+    vector<string_view> patterns;
+    ifstream in(path, ios::binary | ios::ate);
+    streamoff size = in ? (streamoff)in.tellg() : 0;
+    if (size > 0) {
+        char* data = (char*)text.allocate((size_t)size, 1);
+        in.seekg(0);
+        in.read(data, size);
+        size = in.gcount();
+        for (streamoff i = 0; i < size; i++) data[i] = (char)tolower((unsigned char)data[i]);
+        for (size_t pos = 0; pos < (size_t)size;) {
+            const char* end = (const char*)memchr(data + pos, '\n', (size_t)size - pos);
+            size_t stop = end ? (size_t)(end - data) : (size_t)size;
+            size_t len = stop - pos;
+            if (len > 0 && data[pos + len - 1] == '\r') len--;
+            if (len > 0 && data[pos] != '#') patterns.emplace_back(data + pos, len);
+            pos = stop + 1;
+        }
+    }
+    if (patterns.empty())
+        patterns.assign(begin(DEFAULT_WEAK_PATTERNS), end(DEFAULT_WEAK_PATTERNS));
+    return patterns;
+}
+
+// Null, with error set, if the pattern list is too large for the automaton.
+inline shared_ptr<const PatternIndex> buildPatternIndex(const string& patternPath,
+                                                 shared_ptr<const DictionaryIndex> dictionary,
+                                                 shared_ptr<const RangeTable> ranges, string* error = nullptr) {
+    static atomic<uint64_t> generations{0};
+    auto index = make_shared<PatternIndex>();
+    index->generation = ++generations;
+    index->dictionary = move(dictionary);
+    index->ranges = move(ranges);
+    index->patterns = loadWeakPatterns(patternPath, index->text);
+    index->defaultPatterns = equal(index->patterns.begin(), index->patterns.end(),
+                                   begin(DEFAULT_WEAK_PATTERNS), end(DEFAULT_WEAK_PATTERNS));
+    // The static automaton covers the default list, so only a loaded list needs a trie
+    if (g_matchEngine == MatchEngine::AhoCorasick && !index->defaultPatterns) {
+        for (size_t i = 0; i < index->patterns.size(); i++) index->trie.insert(index->patterns[i], (int)i);
+        index->skippedPatterns = index->trie.skippedWords();
+        if (!index->trie.build()) {
+            if (error) *error = patternPath + " has too many patterns for the automaton";
+            return nullptr;
+        }
+    }
+    // Same set the trie ends up with: duplicates report the first id and long patterns never match
+    if (g_matchEngine == MatchEngine::PerPattern) {
+        const vector<string_view>& patterns = index->patterns;
+        vector<int> order(patterns.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+        stable_sort(order.begin(), order.end(), [&](int a, int b) { return patterns[a] < patterns[b]; });
+        vector<bool> duplicate(patterns.size());
+        for (size_t i = 1; i < order.size(); i++)
+            if (patterns[order[i]] == patterns[order[i - 1]]) duplicate[order[i]] = true;
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (patterns[i].length() > 255) { index->skippedPatterns++; continue; }
+            if (duplicate[i]) continue;
+            index->compiled.emplace_back(string(patterns[i]));
+            index->compiledIds.push_back((int)i);
+        }
+    }
+    return index;
+}
+
+struct alignas(64) ReaderSlot {
+    atomic<uint64_t> epoch{0};  // 0 while the thread holds no reader
+    uint32_t depth = 0;         // nested readers; owner thread only
+};
+
+inline mutex g_readerSlotsLock;
+inline vector<unique_ptr<ReaderSlot>> g_readerSlots;       // never shrinks; an exited thread's slot stays idle
+inline atomic<uint64_t> g_indexEpoch{1};
+inline atomic<const PatternIndex*> g_currentIndex{nullptr};
+
+inline mutex g_publishLock;                                // serializes publishers
+inline shared_ptr<const PatternIndex> g_publishedIndex;    // owns *g_currentIndex
+
+inline ReaderSlot& readerSlot() {
+    static thread_local ReaderSlot* slot = [] {
+        lock_guard<mutex> guard(g_readerSlotsLock);
+        g_readerSlots.emplace_back(new ReaderSlot());
+        return g_readerSlots.back().get();
+    }();
+    return *slot;
+}
+
+// Read-side critical section: the snapshot stays valid while the reader is in scope.
+class PatternIndexReader {
+private:
+    ReaderSlot& slot;
+    const PatternIndex* index;
+
+public:
+    PatternIndexReader() : slot(readerSlot()) {
+        // The announcement must be visible before the pointer load, hence seq_cst on both
+        if (slot.depth++ == 0) slot.epoch.store(g_indexEpoch.load(memory_order_acquire), memory_order_seq_cst);
+        index = g_currentIndex.load(memory_order_seq_cst);
+    }
+
+    ~PatternIndexReader() {
+        if (--slot.depth == 0) slot.epoch.store(0, memory_order_release);
+    }
+
+    PatternIndexReader(const PatternIndexReader&) = delete;
+    PatternIndexReader& operator=(const PatternIndexReader&) = delete;
+
+    const PatternIndex& operator*() const { return *index; }
+    const PatternIndex* operator->() const { return index; }
+};
+
+// Guaranteed copy elision lets callers write `auto index = currentPatternIndex();`.
+inline PatternIndexReader currentPatternIndex() {
+    return PatternIndexReader();
+}
+
+// Waits until no reader can still hold a pointer loaded before epoch target began.
+inline void waitForReaders(uint64_t target) {
+    for (;;) {
+        bool drained = true;
+        {
+            lock_guard<mutex> guard(g_readerSlotsLock);
+            for (const auto& slot : g_readerSlots) {
+                uint64_t e = slot->epoch.load(memory_order_seq_cst);
+                if (e != 0 && e < target) { drained = false; break; }
+            }
+        }
+        if (drained) return;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+// Swaps in index and frees the previous snapshot once its readers have drained.
+inline void publishPatternIndex(shared_ptr<const PatternIndex> index) {
+    lock_guard<mutex> guard(g_publishLock);
+    g_currentIndex.store(index.get(), memory_order_seq_cst);
+    uint64_t target = g_indexEpoch.fetch_add(1, memory_order_seq_cst) + 1;
+    shared_ptr<const PatternIndex> old = move(g_publishedIndex);
+    g_publishedIndex = move(index);
+    if (old) waitForReaders(target);
+}
+
+// Returns false (keeping the current snapshot) if the dictionary or range table can't be mapped.
+inline bool reloadPatternIndex(string& error) {
+    shared_ptr<DictionaryIndex> dictionary;
+    if (!g_dictionaryPath.empty()) {
+        dictionary = make_shared<DictionaryIndex>();
+        if (!dictionary->open(g_dictionaryPath, error)) return false;
+    }
+    shared_ptr<RangeTable> ranges;
+    if (!g_rangePath.empty()) {
+        ranges = make_shared<RangeTable>();
+        if (!ranges->open(g_rangePath, error)) return false;
+        if (ranges->shardId() != g_rangeShardId) {
+            error = g_rangePath + " was built for a different shard (rebuild with --build-range --shard)";
+            return false;
+        }
+    }
+    shared_ptr<const PatternIndex> index = buildPatternIndex(WEAK_PATTERN_FILE, move(dictionary), move(ranges), &error);
+    if (!index) return false;       // the old snapshot stays published
+    publishPatternIndex(move(index));
+    return true;
+}
+
+/* =====================================================
+   VECTORIZED CHARACTER PROFILE
+   Classifies 16 or 32 bytes at a time into upper,
+   lower, digit and symbol (anything else, including
+   non-ASCII) and, in the same pass, looks for three
+   identical bytes in a row by comparing each block with
+   itself shifted by one and two. Those shifted loads
+   reach two bytes into the next block, so a triple that
+   straddles a boundary is still seen; the bytes past
+   the last full block go through the scalar tail, which
+   checks every triple starting there. The kernel is
+   chosen once at startup: AVX2 when the CPU has it,
+   otherwise SSE2 (always there on x86-64) or NEON, with
+   a scalar fallback.
+   ===================================================== */
+
+const uint8_t CLASS_UPPER = 1, CLASS_LOWER = 2, CLASS_DIGIT = 4, CLASS_SYMBOL = 8;
+
+struct CharProfile {
+    uint8_t classes = 0;
+    bool hasTriple = false;
+};
+
+inline uint8_t classifyByte(uint8_t c) {
+    if (c >= 'A' && c <= 'Z') return CLASS_UPPER;
+    if (c >= 'a' && c <= 'z') return CLASS_LOWER;
+    if (c >= '0' && c <= '9') return CLASS_DIGIT;
+    return CLASS_SYMBOL;
+}
+
+// Classifies p[from, n) and checks for triples starting at from or later.
+inline void profileTail(const uint8_t* p, size_t from, size_t n, CharProfile& out) {
+    for (size_t i = from; i < n; i++) {
+        out.classes |= classifyByte(p[i]);
+        if (i + 2 < n && p[i] == p[i + 1] && p[i] == p[i + 2]) out.hasTriple = true;
+    }
+}
+
+inline CharProfile profileScalar(string_view s) {
+    CharProfile out;
+    profileTail((const uint8_t*)s.data(), 0, s.size(), out);
+    return out;
+}
+
+#if PW_SIMD_X86
+// Signed-compare range check: (v - lo) as unsigned < count.
+#define PW_RANGE_SSE(v, lo, count) \
+    _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - (lo)))), _mm_set1_epi8((char)(0x80 + (count))))
+
+inline CharProfile profileSse2(string_view s) {
+    const uint8_t* p = (const uint8_t*)s.data();
+    size_t n = s.size(), i = 0;
+    __m128i upper = _mm_setzero_si128(), lower = upper, digit = upper, other = upper, triple = upper;
+    for (; i + 18 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i u = PW_RANGE_SSE(v, 'A', 26), l = PW_RANGE_SSE(v, 'a', 26), d = PW_RANGE_SSE(v, '0', 10);
+        upper = _mm_or_si128(upper, u);
+        lower = _mm_or_si128(lower, l);
+        digit = _mm_or_si128(digit, d);
+        other = _mm_or_si128(other, _mm_andnot_si128(_mm_or_si128(u, _mm_or_si128(l, d)), _mm_set1_epi8(-1)));
+        __m128i e1 = _mm_cmpeq_epi8(v, _mm_loadu_si128((const __m128i*)(p + i + 1)));
+        __m128i e2 = _mm_cmpeq_epi8(v, _mm_loadu_si128((const __m128i*)(p + i + 2)));
+        triple = _mm_or_si128(triple, _mm_and_si128(e1, e2));
+    }
+    CharProfile out;
+    if (_mm_movemask_epi8(upper)) out.classes |= CLASS_UPPER;
+    if (_mm_movemask_epi8(lower)) out.classes |= CLASS_LOWER;
+    if (_mm_movemask_epi8(digit)) out.classes |= CLASS_DIGIT;
+    if (_mm_movemask_epi8(other)) out.classes |= CLASS_SYMBOL;
+    out.hasTriple = _mm_movemask_epi8(triple) != 0;
+    profileTail(p, i, n, out);
+    return out;
+}
+
+#if defined(__GNUC__)
+#define PW_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PW_TARGET_AVX2
+#endif
+
+#define PW_RANGE_AVX(v, lo, count) \
+    _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + (count))), \
+                      _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - (lo)))))
+
+inline PW_TARGET_AVX2 CharProfile profileAvx2(string_view s) {
+    const uint8_t* p = (const uint8_t*)s.data();
+    size_t n = s.size(), i = 0;
+    __m256i upper = _mm256_setzero_si256(), lower = upper, digit = upper, other = upper, triple = upper;
+    for (; i + 34 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i u = PW_RANGE_AVX(v, 'A', 26), l = PW_RANGE_AVX(v, 'a', 26), d = PW_RANGE_AVX(v, '0', 10);
+        upper = _mm256_or_si256(upper, u);
+        lower = _mm256_or_si256(lower, l);
+        digit = _mm256_or_si256(digit, d);
+        other = _mm256_or_si256(other, _mm256_andnot_si256(_mm256_or_si256(u, _mm256_or_si256(l, d)),
+                                                           _mm256_set1_epi8(-1)));
+        __m256i e1 = _mm256_cmpeq_epi8(v, _mm256_loadu_si256((const __m256i*)(p + i + 1)));
+        __m256i e2 = _mm256_cmpeq_epi8(v, _mm256_loadu_si256((const __m256i*)(p + i + 2)));
+        triple = _mm256_or_si256(triple, _mm256_and_si256(e1, e2));
+    }
+    CharProfile out;
+    if (_mm256_movemask_epi8(upper)) out.classes |= CLASS_UPPER;
+    if (_mm256_movemask_epi8(lower)) out.classes |= CLASS_LOWER;
+    if (_mm256_movemask_epi8(digit)) out.classes |= CLASS_DIGIT;
+    if (_mm256_movemask_epi8(other)) out.classes |= CLASS_SYMBOL;
+    out.hasTriple = _mm256_movemask_epi8(triple) != 0;
+    CharProfile tail = profileSse2(string_view(s.data() + i, n - i));
+    out.classes |= tail.classes;
+    out.hasTriple |= tail.hasTriple;
+    return out;
+}
+#endif
+
+#if PW_SIMD_NEON
+inline uint8x16_t rangeNeon(uint8x16_t v, uint8_t lo, uint8_t count) {
+    return vcltq_u8(vsubq_u8(v, vdupq_n_u8(lo)), vdupq_n_u8(count));
+}
+
+inline CharProfile profileNeon(string_view s) {
+    const uint8_t* p = (const uint8_t*)s.data();
+    size_t n = s.size(), i = 0;
+    uint8x16_t upper = vdupq_n_u8(0), lower = upper, digit = upper, other = upper, triple = upper;
+    for (; i + 18 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(p + i);
+        uint8x16_t u = rangeNeon(v, 'A', 26), l = rangeNeon(v, 'a', 26), d = rangeNeon(v, '0', 10);
+        upper = vorrq_u8(upper, u);
+        lower = vorrq_u8(lower, l);
+        digit = vorrq_u8(digit, d);
+        other = vorrq_u8(other, vmvnq_u8(vorrq_u8(u, vorrq_u8(l, d))));
+        triple = vorrq_u8(triple, vandq_u8(vceqq_u8(v, vld1q_u8(p + i + 1)), vceqq_u8(v, vld1q_u8(p + i + 2))));
+    }
+    CharProfile out;
+    if (vmaxvq_u8(upper)) out.classes |= CLASS_UPPER;
+    if (vmaxvq_u8(lower)) out.classes |= CLASS_LOWER;
+    if (vmaxvq_u8(digit)) out.classes |= CLASS_DIGIT;
+    if (vmaxvq_u8(other)) out.classes |= CLASS_SYMBOL;
+    out.hasTriple = vmaxvq_u8(triple) != 0;
+    profileTail(p, i, n, out);
+    return out;
+}
+#endif
+
+using ProfileKernel = CharProfile (*)(string_view);
+
+inline ProfileKernel selectProfileKernel() {
+#if PW_SIMD_X86
+#if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) return profileAvx2;
+#endif
+    return profileSse2;
+#elif PW_SIMD_NEON
+    return profileNeon;
+#else
+    return profileScalar;
+#endif
+}
+
+const ProfileKernel profileChars = selectProfileKernel();
+
+/* =====================================================
+   RUN DETECTION (REPEATS, SEQUENCES, KEYBOARD WALKS)
+   One pass over the password tracks three runs at once:
+   identical characters ("aaa"), alphabet or digit steps
+   of +1/-1 ("abcd", "9876") and neighbouring keys on one
+   keyboard row ("qwer", "lkjh"). The longest of each kind
+   is reported with its position.
+   ===================================================== */
+
+const size_t MIN_REPEAT_RUN = 3;
+const size_t MIN_SEQUENCE_RUN = 4;
+const size_t MIN_KEYBOARD_RUN = 4;
+
+struct Run {
+    size_t start = 0;
+    size_t length = 0;
+};
+
+struct RunReport {
+    Run repeat;
+    Run sequence;
+    Run keyboard;
+};
+
+// Row and column of each lowercase letter on a QWERTY layout, or -1.
+struct KeyboardLayout {
+    int8_t row[256];
+    int8_t col[256];
+
+    constexpr KeyboardLayout() : row(), col() {
+        for (int i = 0; i < 256; i++) row[i] = col[i] = -1;
+        const char* rows[] = {"qwertyuiop", "asdfghjkl", "zxcvbnm"};
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; rows[r][c]; c++) {
+                row[(uint8_t)rows[r][c]] = (int8_t)r;
+                col[(uint8_t)rows[r][c]] = (int8_t)c;
+            }
+    }
+};
+
+constexpr KeyboardLayout KEYBOARD;
+
+inline void extendRun(Run& longest, size_t end, size_t length) {
+    if (length > longest.length) longest = {end + 1 - length, length};
+}
+
+inline bool asciiDigit(uint8_t c) { return (unsigned)(c - '0') < 10u; }
+inline bool asciiLowerLetter(uint8_t c) { return (unsigned)(c - 'a') < 26u; }
+inline uint8_t asciiLower(uint8_t c) { return (unsigned)(c - 'A') < 26u ? c + 32 : c; }
+
+// Direction (+1/-1) of the step from a to b within one run kind, or 0.
+inline int sequenceStep(uint8_t a, uint8_t b) {
+    bool digits = asciiDigit(a) && asciiDigit(b);
+    bool letters = asciiLowerLetter(a) && asciiLowerLetter(b);
+    int step = (int)b - (int)a;
+    return (digits || letters) && (step == 1 || step == -1) ? step : 0;
+}
+
+inline int keyboardStep(uint8_t a, uint8_t b) {
+    if (KEYBOARD.row[a] < 0 || KEYBOARD.row[a] != KEYBOARD.row[b]) return 0;
+    int step = KEYBOARD.col[b] - KEYBOARD.col[a];
+    return step == 1 || step == -1 ? step : 0;
+}
+
+inline RunReport scanRuns(string_view pass) {
+    RunReport report;
+    if (pass.empty()) return report;
+    report.repeat.length = report.sequence.length = report.keyboard.length = 1;
+
+    size_t repeatLen = 1, seqLen = 1, keyLen = 1;
+    int seqDir = 0, keyDir = 0;
+    for (size_t i = 1; i < pass.length(); i++) {
+        uint8_t a = asciiLower((uint8_t)pass[i - 1]);
+        uint8_t b = asciiLower((uint8_t)pass[i]);
+
+        repeatLen = pass[i] == pass[i - 1] ? repeatLen + 1 : 1;
+        extendRun(report.repeat, i, repeatLen);
+
+        int step = sequenceStep(a, b);
+        seqLen = !step ? 1 : step == seqDir ? seqLen + 1 : 2;
+        seqDir = step;
+        extendRun(report.sequence, i, seqLen);
+
+        step = keyboardStep(a, b);
+        keyLen = !step ? 1 : step == keyDir ? keyLen + 1 : 2;
+        keyDir = step;
+        extendRun(report.keyboard, i, keyLen);
+    }
+    return report;
+}
+
+/* =====================================================
+   GUESS ESTIMATOR (ZXCVBN-STYLE)
+   Collects every dictionary, l33t, keyboard, repeat,
+   sequence and date match in the password, gives each an
+   estimated number of guesses, and finds the cheapest
+   way to cover the password with matches and brute-force
+   characters by dynamic programming over positions. The
+   ranked words share one small automaton, the l33t and
+   keyboard tables are constexpr, everything else lives
+   on the stack, and only the first
+   MAX_ESTIMATE_LENGTH characters are matched, so each
+   call is bounded and allocation-free. Past that the
+   rest is covered by the cheap run matchers, repeats of
+   earlier text included, in one linear pass, and a
+   password that is one block over and over costs the
+   block's guesses times the repeat count, as in zxcvbn.
+   ===================================================== */
+
+const size_t MAX_ESTIMATE_LENGTH = 64;
+const size_t MAX_ESTIMATE_MATCHES = 512;
+const double BRUTEFORCE_LOG10_PER_CHAR = 1.0;      // zxcvbn's cardinality of 10
+const double LOG10_MIN_SINGLE_CHAR_GUESSES = 1.0;
+const double LOG10_MIN_MULTI_CHAR_GUESSES = 1.7;   // 50 guesses
+const double LOG10_MATCH_PENALTY = 0.30103;        // x2 per extra match in the sequence
+const int MIN_YEAR_SPACE = 20;
+
+// Most common passwords and words, most common first; rank = position + 1.
+constexpr const char* RANKED_WORDS[] = {
+    "password", "123456", "12345678", "qwerty", "123456789", "12345", "1234", "111111",
+    "1234567", "dragon", "123123", "baseball", "abc123", "football", "monkey", "letmein",
+    "696969", "shadow", "master", "666666", "qwertyuiop", "123321", "mustang", "1234567890",
+    "michael", "654321", "superman", "1qaz2wsx", "7777777", "121212", "000000", "qazwsx",
+    "123qwe", "killer", "trustno1", "jordan", "jennifer", "zxcvbnm", "asdfgh", "hunter",
+    "buster", "soccer", "harley", "batman", "andrew", "tigger", "sunshine", "iloveyou",
+    "charlie", "robert", "thomas", "hockey", "ranger", "daniel", "starwars", "112233",
+    "george", "computer", "michelle", "jessica", "pepper", "1111", "zxcvbn", "555555",
+    "11111111", "131313", "freedom", "777777", "pass", "maggie", "159753", "aaaaaa",
+    "ginger", "princess", "joshua", "cheese", "amanda", "summer", "love", "ashley",
+    "nicole", "chelsea", "biteme", "matthew", "access", "yankees", "987654321", "dallas",
+    "austin", "thunder", "taylor", "matrix", "admin", "welcome", "login", "hello",
+    "secret", "monday", "winter", "spring", "flower", "purple", "orange", "banana",
+    "apple", "chocolate", "cookie", "angel", "baby", "lovely", "family", "friend",
+    "money", "dog", "cat", "god", "jesus", "london", "pokemon", "samsung",
+    "google", "internet", "qwer", "asdf", "test", "guest", "root", "user",
+};
+
+constexpr size_t RANKED_WORD_COUNT = sizeof(RANKED_WORDS) / sizeof(RANKED_WORDS[0]);
+
+// Ranked words compiled into their own automaton; pattern ids are word ranks - 1.
+constexpr StaticAutomaton<RANKED_WORDS> RANKED_WORD_AUTOMATON;
+
+// Most likely plain letter behind a l33t character; two tables for the ambiguous '1' and '|'.
+struct LeetTable {
+    char map[256];
+
+    constexpr LeetTable(bool oneIsL) : map() {
+        map['4'] = 'a'; map['@'] = 'a'; map['8'] = 'b'; map['('] = 'c'; map['3'] = 'e';
+        map['6'] = 'g'; map['9'] = 'g'; map['0'] = 'o'; map['5'] = 's'; map['$'] = 's';
+        map['7'] = 't'; map['+'] = 't'; map['2'] = 'z'; map['!'] = 'i';
+        map['1'] = oneIsL ? 'l' : 'i';
+        map['|'] = oneIsL ? 'i' : 'l';
+    }
+};
+
+constexpr LeetTable LEET_TABLES[2] = {LeetTable(false), LeetTable(true)};
+
+enum MatchKind : uint8_t {
+    KIND_DICTIONARY, KIND_LEET, KIND_WEAK_PATTERN, KIND_KEYBOARD,
+    KIND_REPEAT, KIND_SEQUENCE, KIND_DATE, KIND_COUNT
+};
+
+struct GuessMatch {
+    uint8_t start, end;     // [start, end)
+    uint8_t kind;
+    float log10Guesses;
+};
+
+struct GuessEstimate {
+    double log10Guesses = 0;
+    uint32_t kinds = 0;     // bit per MatchKind used in the cheapest cover
+};
+
+struct MatchList {
+    GuessMatch items[MAX_ESTIMATE_MATCHES];
+    size_t count = 0;
+
+    void add(size_t start, size_t end, MatchKind kind, double log10Guesses) {
+        if (count == MAX_ESTIMATE_MATCHES || end <= start) return;
+        double floor = end - start == 1 ? LOG10_MIN_SINGLE_CHAR_GUESSES : LOG10_MIN_MULTI_CHAR_GUESSES;
+        items[count++] = {(uint8_t)start, (uint8_t)end, (uint8_t)kind, (float)max(log10Guesses, floor)};
+    }
+};
+
+// log10(n!) for every n a match can span; a table because lgamma isn't thread-safe (signgam).
+const array<double, MAX_ESTIMATE_LENGTH + 1> LOG10_FACTORIAL = [] {
+    array<double, MAX_ESTIMATE_LENGTH + 1> table{};
+    for (size_t n = 1; n <= MAX_ESTIMATE_LENGTH; n++) table[n] = table[n - 1] + log10((double)n);
+    return table;
+}();
+
+inline double log10Binomial(int n, int k) {
+    return LOG10_FACTORIAL[n] - LOG10_FACTORIAL[k] - LOG10_FACTORIAL[n - k];
+}
+
+// Extra guesses for the capitalization pattern of pass[start, end), as in zxcvbn.
+inline double log10UppercaseVariations(string_view pass, size_t start, size_t end) {
+    int upper = 0, lower = 0;
+    for (size_t i = start; i < end; i++) {
+        if (pass[i] >= 'A' && pass[i] <= 'Z') upper++;
+        else if (pass[i] >= 'a' && pass[i] <= 'z') lower++;
+    }
+    if (upper == 0) return 0;
+    bool firstOnly = upper == 1 && pass[start] >= 'A' && pass[start] <= 'Z';
+    bool lastOnly = upper == 1 && pass[end - 1] >= 'A' && pass[end - 1] <= 'Z';
+    if (firstOnly || lastOnly || lower == 0) return log10(2.0);
+    double sum = 0;
+    for (int k = 1; k <= min(upper, lower); k++) sum += pow(10.0, log10Binomial(upper + lower, k));
+    return log10(sum);
+}
+
+// Ranked-word matches in text (lowercase, possibly un-l33ted) in one automaton pass.
+inline void matchRankedWords(string_view text, string_view pass, string_view lower, bool leet, MatchList& out) {
+    RANKED_WORD_AUTOMATON.scan(text, [&](const PatternMatch& m) {
+        size_t stop = m.start + m.length;
+        int substitutions = 0;
+        for (size_t k = m.start; k < stop; k++) substitutions += text[k] != lower[k];
+        if (leet && substitutions == 0) return;     // already found as a plain match
+        double guesses = log10(m.patternId + 1.0) + log10UppercaseVariations(pass, m.start, stop) +
+                         substitutions * log10(2.0);
+        out.add(m.start, stop, leet ? KIND_LEET : KIND_DICTIONARY, guesses);
+    });
+}
+
+inline int referenceYear() {
+    time_t now = time(nullptr);
+    tm parts = {};
+#ifdef _WIN32
+    gmtime_s(&parts, &now);
+#else
+    gmtime_r(&now, &parts);
+#endif
+    return parts.tm_year + 1900;
+}
+
+const int REFERENCE_YEAR = referenceYear();
+
+inline double log10YearSpace(int year) {
+    return log10((double)max(abs(year - REFERENCE_YEAR), MIN_YEAR_SPACE));
+}
+
+inline int digitsValue(string_view s, size_t pos, size_t count) {
+    int v = 0;
+    for (size_t i = 0; i < count; i++) v = v * 10 + (s[pos + i] - '0');
+    return v;
+}
+
+inline int expandYear(int year, size_t digits) {
+    if (digits == 4) return year;
+    return year > 50 ? 1900 + year : 2000 + year;
+}
+
+inline bool plausibleDate(int day, int month, int year) {
+    return day >= 1 && day <= 31 && month >= 1 && month <= 12 && year >= 1000 && year <= 2050;
+}
+
+// Digit-only dates (4 to 8 digits) and years, plus separated forms like 1/2/1990.
+inline void matchDates(string_view pass, MatchList& out) {
+    size_t n = pass.size();
+    for (size_t i = 0; i < n; i++) {
+        if (!isdigit((uint8_t)pass[i])) continue;
+        size_t run = i;
+        while (run < n && run - i < 8 && isdigit((uint8_t)pass[run])) run++;
+        for (size_t len = 4; i + len <= run; len++) {
+            bool found = false;
+            int bestYear = 0;
+            if (len == 4) {
+                int year = digitsValue(pass, i, 4);
+                if (year >= 1900 && year <= 2039) out.add(i, i + 4, KIND_DATE, log10YearSpace(year));
+            }
+            // day/month in front (dmy, mdy) or year in front (ymd), 2- or 4-digit years
+            for (size_t yearDigits : {(size_t)2, (size_t)4}) {
+                if (len < yearDigits + 2) continue;
+                size_t rest = len - yearDigits;
+                if (rest != 2 && rest != 3 && rest != 4) continue;
+                for (size_t split = 1; split < rest; split++) {
+                    if (split > 2 || rest - split > 2) continue;
+                    int a = digitsValue(pass, i + yearDigits, split), b = digitsValue(pass, i + yearDigits + split, rest - split);
+                    int yFront = expandYear(digitsValue(pass, i, yearDigits), yearDigits);
+                    if (plausibleDate(b, a, yFront) || plausibleDate(a, b, yFront)) { found = true; bestYear = yFront; }
+                    a = digitsValue(pass, i, split);
+                    b = digitsValue(pass, i + split, rest - split);
+                    int yBack = expandYear(digitsValue(pass, i + rest, yearDigits), yearDigits);
+                    if (plausibleDate(a, b, yBack) || plausibleDate(b, a, yBack)) { found = true; bestYear = yBack; }
+                }
+            }
+            if (found) out.add(i, i + len, KIND_DATE, log10(365.0) + log10YearSpace(bestYear));
+        }
+    }
+    // d/m/yyyy, dd-mm-yy, yyyy.mm.dd and friends
+    for (size_t i = 0; i + 6 <= n; i++) {
+        size_t parts[3] = {0, 0, 0}, starts[3] = {0, 0, 0}, p = i;
+        char sep = 0;
+        int k = 0;
+        for (; k < 3 && p < n; k++) {
+            starts[k] = p;
+            while (p < n && p - starts[k] < 4 && isdigit((uint8_t)pass[p])) p++;
+            parts[k] = p - starts[k];
+            if (parts[k] == 0) break;
+            if (k < 2) {
+                if (p >= n || !strchr("/-._ ", pass[p]) || (sep && pass[p] != sep)) { parts[k] = 0; break; }
+                sep = pass[p++];
+            }
+        }
+        if (k < 3 || !parts[2]) continue;
+        int v[3];
+        for (int j = 0; j < 3; j++) v[j] = digitsValue(pass, starts[j], parts[j]);
+        int year = 0;
+        if (parts[0] == 4 && parts[1] <= 2 && parts[2] <= 2 && plausibleDate(v[2], v[1], v[0])) year = v[0];
+        else if (parts[0] <= 2 && parts[1] <= 2 && (parts[2] == 2 || parts[2] == 4)) {
+            int y = expandYear(v[2], parts[2]);
+            if (plausibleDate(v[0], v[1], y) || plausibleDate(v[1], v[0], y)) year = y;
+        }
+        if (year) out.add(i, p, KIND_DATE, log10(365.0) + log10YearSpace(year) + log10(4.0));
+    }
+}
+
+// Every maximal repeat, sequence and keyboard run of length 3 or more.
+inline void matchRuns(string_view pass, MatchList& out) {
+    size_t n = pass.size();
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && pass[j] == pass[i]) j++;
+        if (j - i >= 3) {
+            uint8_t c = (uint8_t)pass[i];
+            double cardinality = asciiDigit(c) ? 10 : asciiLowerLetter(asciiLower(c)) ? 26 : 33;
+            out.add(i, j, KIND_REPEAT, log10(cardinality * (j - i)));
+        }
+        i = j;
+    }
+    for (size_t i = 0; i + 1 < n;) {
+        int dir = sequenceStep(asciiLower((uint8_t)pass[i]), asciiLower((uint8_t)pass[i + 1]));
+        size_t j = i + 1;
+        while (dir && j < n && sequenceStep(asciiLower((uint8_t)pass[j - 1]), asciiLower((uint8_t)pass[j])) == dir)
+            j++;
+        if (dir && j - i >= 3) {
+            char first = (char)asciiLower((uint8_t)pass[i]);
+            double base = strchr("az019", first) ? 4 : asciiDigit((uint8_t)first) ? 10 : 26;
+            out.add(i, j, KIND_SEQUENCE, log10(base * (j - i) * (dir < 0 ? 2 : 1)));
+        }
+        i = max(i + 1, j - 1);
+    }
+    for (size_t i = 0; i + 1 < n;) {
+        int dir = keyboardStep(asciiLower((uint8_t)pass[i]), asciiLower((uint8_t)pass[i + 1]));
+        size_t j = i + 1;
+        while (dir && j < n && keyboardStep(asciiLower((uint8_t)pass[j - 1]), asciiLower((uint8_t)pass[j])) == dir)
+            j++;
+        if (dir && j - i >= 3)
+            out.add(i, j, KIND_KEYBOARD, log10(26.0 * 2 * (j - i)) + log10UppercaseVariations(pass, i, j));
+        i = max(i + 1, j - 1);
+    }
+}
+
+// Shortest p with s[i] == s[i - p] throughout and at least two whole blocks, or 0.
+inline size_t shortestPeriod(string_view s) {
+    for (size_t p = 1; p <= MAX_ESTIMATE_LENGTH && 2 * p <= s.size(); p++)
+        if (memcmp(s.data(), s.data() + p, s.size() - p) == 0) return p;
+    return 0;
+}
+
+// Length of the run of pass from i on whose neighbours all differ by the same step.
+template <typename Step>
+size_t stepRunFrom(string_view pass, size_t i, Step step) {
+    if (i + 1 >= pass.size()) return 1;
+    int dir = step(asciiLower((uint8_t)pass[i]), asciiLower((uint8_t)pass[i + 1]));
+    size_t j = i + 1;
+    while (dir && j < pass.size() && step(asciiLower((uint8_t)pass[j - 1]), asciiLower((uint8_t)pass[j])) == dir) j++;
+    return dir ? j - i : 1;
+}
+
+/* Guesses for pass[from, end) after the matched head: greedily the longest
+   repeat of earlier text, same-character, sequence or keyboard run at each
+   position, priced like matchRuns, and brute force where none starts. */
+inline double log10TailGuesses(string_view pass, size_t from, uint32_t& kinds) {
+    double total = 0;
+    for (size_t i = from; i < pass.size();) {
+        size_t length = 1;
+        double cost = BRUTEFORCE_LOG10_PER_CHAR;
+        MatchKind kind = KIND_COUNT;
+        auto consider = [&](size_t len, MatchKind k, double guesses) {
+            if (len < MIN_REPEAT_RUN || len <= length) return;
+            length = len;
+            kind = k;
+            cost = max(guesses, LOG10_MIN_MULTI_CHAR_GUESSES) + LOG10_MATCH_PENALTY;
+        };
+        // A repeat of the preceding p characters only costs the extra repeat count
+        for (size_t p = 1; p <= min(i, MAX_ESTIMATE_LENGTH) && i + length < pass.size(); p++) {
+            size_t len = 0;
+            while (i + len < pass.size() && pass[i + len] == pass[i + len - p]) len++;
+            consider(len, KIND_REPEAT, log10((double)(len + p) / p));
+        }
+        size_t same = 1;
+        while (i + same < pass.size() && pass[i + same] == pass[i]) same++;
+        uint8_t c = asciiLower((uint8_t)pass[i]);
+        consider(same, KIND_REPEAT, log10((asciiDigit(c) ? 10 : asciiLowerLetter(c) ? 26 : 33) * (double)same));
+        size_t run = stepRunFrom(pass, i, sequenceStep);
+        consider(run, KIND_SEQUENCE, log10((asciiDigit(c) ? 10 : 26) * 2.0 * run));
+        run = stepRunFrom(pass, i, keyboardStep);
+        consider(run, KIND_KEYBOARD, log10(26.0 * 2 * run));
+        if (kind != KIND_COUNT) kinds |= 1u << kind;
+        total += cost;
+        i += length;
+    }
+    return total;
+}
+
+// Text that repeats the p characters before it at least once, priced by the repeat count.
+inline void matchRepeatedBlocks(string_view pass, MatchList& out) {
+    size_t n = pass.size();
+    for (size_t p = 2; 2 * p <= n; p++)         // p = 1 is a same-character run, found by matchRuns
+        for (size_t i = p; i < n;) {
+            size_t j = i;
+            while (j < n && pass[j] == pass[j - p]) j++;
+            if (j - i >= p) out.add(i, j, KIND_REPEAT, log10((double)(j - i + p) / p));
+            i = j + 1;
+        }
+}
+
+/* `patterns` are the weak-pattern and dictionary hits already found by the
+   analyzer; dictionaryWords sizes the guess space for the latter. */
+inline GuessEstimate estimateGuesses(string_view pass, string_view lower, const PatternMatch* patterns,
+                              size_t patternCount, uint32_t dictionaryWords) {
+    GuessEstimate estimate;
+    // One block repeated: matches inside the block are found on it alone
+    if (size_t period = shortestPeriod(pass)) {
+        estimate = estimateGuesses(pass.substr(0, period), lower.substr(0, period), patterns, patternCount,
+                                   dictionaryWords);
+        estimate.log10Guesses += log10((double)pass.size() / period);
+        estimate.kinds |= 1u << KIND_REPEAT;
+        return estimate;
+    }
+    size_t n = min(pass.size(), MAX_ESTIMATE_LENGTH);
+    string_view head = pass.substr(0, n), lowerHead = lower.substr(0, n);
+
+    static thread_local MatchList matches;
+    matches.count = 0;
+    matchRankedWords(lowerHead, head, lowerHead, false, matches);
+    bool hasLeet = false, hasAmbiguous = false;
+    for (char c : lowerHead) {
+        hasLeet |= LEET_TABLES[0].map[(uint8_t)c] != 0;
+        hasAmbiguous |= c == '1' || c == '|';
+    }
+    if (hasLeet) {
+        char buf[MAX_ESTIMATE_LENGTH];
+        for (size_t t = 0; t < (hasAmbiguous ? 2 : 1); t++) {     // the tables only differ on '1' and '|'
+            const LeetTable& table = LEET_TABLES[t];
+            for (size_t i = 0; i < n; i++) {
+                char sub = table.map[(uint8_t)lowerHead[i]];
+                buf[i] = sub ? sub : lowerHead[i];
+            }
+            matchRankedWords(string_view(buf, n), head, lowerHead, true, matches);
+        }
+    }
+    for (size_t i = 0; i < patternCount; i++) {
+        const PatternMatch& m = patterns[i];
+        if (m.start + m.length > n) continue;
+        double rank = m.patternId >= 0 ? m.patternId + 1.0 : max<double>(dictionaryWords, 1) / 2;
+        matches.add(m.start, m.start + m.length, KIND_WEAK_PATTERN, log10(rank) + log10UppercaseVariations(head, m.start, m.start + m.length));
+    }
+    matchRuns(head, matches);
+    matchRepeatedBlocks(head, matches);
+    matchDates(head, matches);
+
+    // best[j]: fewest log10 guesses to produce head[0, j); brute force costs one digit per char.
+    double best[MAX_ESTIMATE_LENGTH + 1];
+    int via[MAX_ESTIMATE_LENGTH + 1];      // match index ending at j, or -1 for brute force
+    best[0] = 0;
+    via[0] = -1;
+    sort(matches.items, matches.items + matches.count,
+         [](const GuessMatch& a, const GuessMatch& b) { return a.end < b.end; });
+    size_t next = 0;
+    for (size_t j = 1; j <= n; j++) {
+        best[j] = best[j - 1] + BRUTEFORCE_LOG10_PER_CHAR;
+        via[j] = -1;
+        for (; next < matches.count && matches.items[next].end == j; next++) {
+            const GuessMatch& m = matches.items[next];
+            double cost = best[m.start] + m.log10Guesses + (m.start ? LOG10_MATCH_PENALTY : 0);
+            if (cost < best[j]) { best[j] = cost; via[j] = (int)next; }
+        }
+    }
+    for (size_t j = n; j > 0;) {
+        if (via[j] < 0) { j--; continue; }
+        const GuessMatch& m = matches.items[via[j]];
+        estimate.kinds |= 1u << m.kind;
+        j = m.start;
+    }
+    estimate.log10Guesses = best[n] + log10TailGuesses(pass, n, estimate.kinds);
+    return estimate;
+}
+
+/* =====================================================
+   METRICS
+   Every thread writes its own shard of counters and
+   histograms with plain relaxed loads and stores (no
+   locked instructions), and /metrics merges the shards
+   only when scraped. Histograms are HDR-style: four
+   linear sub-buckets per power of two from 64 ns up, so
+   any recorded latency is within 25% of its bucket
+   bound. Per-stage timings are sampled on one call in
+   METRICS_STAGE_SAMPLE to keep clock reads off most of
+   the hot path; counters are exact.
+   ===================================================== */
+
+enum Endpoint : uint8_t {
+    ENDPOINT_ANALYZE, ENDPOINT_BATCH, ENDPOINT_STREAM, ENDPOINT_RANGE, ENDPOINT_BINARY, ENDPOINT_BREACH, ENDPOINT_ADMIN,
+    ENDPOINT_COUNT
+};
+const char* const ENDPOINT_NAMES[ENDPOINT_COUNT] = {"analyze", "batch", "stream", "range", "binary", "breach", "admin"};
+
+enum Stage : uint8_t { STAGE_CHECKS, STAGE_RUNS, STAGE_PATTERNS, STAGE_ESTIMATE, STAGE_JSON, STAGE_COUNT };
+const char* const STAGE_NAMES[STAGE_COUNT] = {"checks", "runs", "patterns", "estimate", "json"};
+
+const int HISTOGRAM_MIN_SHIFT = 6;          // first bucket is <= 64 ns
+const int HISTOGRAM_OCTAVES = 24;           // up to about 1 s
+const int HISTOGRAM_SUB_BUCKETS = 4;
+const int HISTOGRAM_BUCKETS = 1 + HISTOGRAM_OCTAVES * HISTOGRAM_SUB_BUCKETS;     // plus overflow
+const uint32_t METRICS_STAGE_SAMPLE = 16;
+
+typedef atomic<uint64_t> MetricCounter;
+
+// Single-writer add: the owning thread is the only one that stores.
+inline void bump(MetricCounter& counter, uint64_t by = 1) {
+    counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+inline uint64_t nowNanos() {
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline int highestBit(uint64_t v) {     // v > 0
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int bit = 0;
+    while (v >>= 1) bit++;
+    return bit;
+#endif
+}
+
+// Inclusive upper bound of bucket i in nanoseconds.
+inline uint64_t histogramBound(int i) {
+    if (i == 0) return 1ull << HISTOGRAM_MIN_SHIFT;
+    int octave = (i - 1) / HISTOGRAM_SUB_BUCKETS, sub = (i - 1) % HISTOGRAM_SUB_BUCKETS;
+    int shift = HISTOGRAM_MIN_SHIFT + octave - 2;
+    return (uint64_t)(HISTOGRAM_SUB_BUCKETS + sub + 1) << shift;
+}
+
+struct Histogram {
+    MetricCounter buckets[HISTOGRAM_BUCKETS + 1] = {};     // the last one is overflow
+    MetricCounter count{0}, sumNanos{0};
+
+    void record(uint64_t nanos) {
+        int i = 0;
+        uint64_t v = nanos ? nanos - 1 : 0;     // bounds are inclusive
+        if (v >= (1ull << HISTOGRAM_MIN_SHIFT)) {
+            int top = highestBit(v);
+            int sub = (int)(v >> (top - 2)) & (HISTOGRAM_SUB_BUCKETS - 1);
+            i = min(HISTOGRAM_BUCKETS, 1 + (top - HISTOGRAM_MIN_SHIFT) * HISTOGRAM_SUB_BUCKETS + sub);
+        }
+        bump(buckets[i]);
+        bump(count);
+        bump(sumNanos, nanos);
+    }
+};
+
+struct MetricsShard {
+    MetricCounter requests[ENDPOINT_COUNT] = {}, rejected[ENDPOINT_COUNT] = {};
+    MetricCounter bytesIn[ENDPOINT_COUNT] = {}, bytesOut[ENDPOINT_COUNT] = {};
+    MetricCounter abandoned[ENDPOINT_COUNT] = {}, limited[ENDPOINT_COUNT] = {}, shed[ENDPOINT_COUNT] = {};
+    MetricCounter passwords{0};
+    Histogram requestLatency[ENDPOINT_COUNT];
+    Histogram stages[STAGE_COUNT];
+    uint32_t sampleTicks[STAGE_COUNT] = {};     // owner-only, per first timed stage
+};
+
+inline mutex g_metricsLock;
+inline vector<unique_ptr<MetricsShard>> g_metricsShards;      // never shrinks, so counts outlive their threads
+
+inline MetricsShard& threadMetrics() {
+    static thread_local MetricsShard* shard = [] {
+        lock_guard<mutex> guard(g_metricsLock);
+        g_metricsShards.emplace_back(new MetricsShard());
+        return g_metricsShards.back().get();
+    }();
+    return *shard;
+}
+
+// Times consecutive stages of one call when it is picked for sampling.
+class StageTimer {
+private:
+    MetricsShard& shard;
+    bool on;
+    uint64_t last = 0;
+
+public:
+    explicit StageTimer(Stage first)
+        : shard(threadMetrics()), on(++shard.sampleTicks[first] % METRICS_STAGE_SAMPLE == 0) {
+        if (on) last = nowNanos();
+    }
+
+    void lap(Stage stage) {
+        if (!on) return;
+        uint64_t now = nowNanos();
+        shard.stages[stage].record(now - last);
+        last = now;
+    }
+};
+
+// Records one request when it goes out of scope; handlers fill in the byte and reject counts.
+struct RequestMetrics {
+    Endpoint endpoint;
+    uint64_t started = nowNanos();
+    size_t bytesIn = 0, bytesOut = 0, rejected = 0;
+    bool abandoned = false;     // the client left before the work started
+    bool limited = false;       // refused by the client's rate limit
+    bool shed = false;          // refused because the server was overloaded
+
+    RequestMetrics(Endpoint e, size_t in) : endpoint(e), bytesIn(in) {}
+
+    ~RequestMetrics() {
+        MetricsShard& shard = threadMetrics();
+        bump(shard.requests[endpoint]);
+        bump(shard.rejected[endpoint], rejected);
+        bump(shard.abandoned[endpoint], abandoned);
+        bump(shard.limited[endpoint], limited);
+        bump(shard.shed[endpoint], shed);
+        bump(shard.bytesIn[endpoint], bytesIn);
+        bump(shard.bytesOut[endpoint], bytesOut);
+        shard.requestLatency[endpoint].record(nowNanos() - started);
+    }
+};
+
+/* =====================================================
+   PASSWORD ANALYSIS
+   Strength and score come from the guess estimator; the
+   rule checks only produce suggestions. Results go into
+   a caller-owned AnalysisResult with suggestions as
+   bitflags over static text, and the lowercased copy
+   lives in per-thread scratch, so a steady-state call
+   makes no heap allocations.
+   ===================================================== */
+
+enum Suggestion : uint32_t {
+    SUGGEST_LENGTH = 1u << 0,
+    SUGGEST_UPPER = 1u << 1,
+    SUGGEST_LOWER = 1u << 2,
+    SUGGEST_DIGIT = 1u << 3,
+    SUGGEST_SYMBOL = 1u << 4,
+    SUGGEST_NO_REPEAT = 1u << 5,
+    SUGGEST_NO_SEQUENCE = 1u << 6,
+    SUGGEST_NO_KEYBOARD = 1u << 7,
+    SUGGEST_NO_WEAK_PATTERN = 1u << 8,
+    SUGGEST_NO_COMMON_WORD = 1u << 9,
+    SUGGEST_NO_DATE = 1u << 10,
+    SUGGEST_NOT_BREACHED = 1u << 11,
+};
+
+const int SUGGESTION_COUNT = 12;
+
+// Indexed by bit position in Suggestion.
+const char* const SUGGESTION_TEXT[SUGGESTION_COUNT] = {
+    "Use at least 8 characters.",
+    "Add uppercase letters.",
+    "Add lowercase letters.",
+    "Add numbers.",
+    "Add symbols (#, @, !).",
+    "Avoid repeating characters.",
+    "Avoid sequences like 'abcd' or '9876'.",
+    "Avoid keyboard patterns like 'asdf'.",
+    "Remove common weak patterns like '1234'.",
+    "Avoid common words and passwords, even with substitutions like '@' for 'a'.",
+    "Avoid dates and years.",
+    "This password appears in a breached-password list; choose a different one.",
+};
+
+enum class Strength : uint8_t { Weak, Moderate, Strong };
+
+inline const char* strengthName(Strength s) {
+    switch (s) {
+    case Strength::Weak: return "Weak";
+    case Strength::Moderate: return "Moderate";
+    default: return "Strong";
+    }
+}
+
+const size_t MAX_REPORTED_MATCHES = 16;
+
+// Score is log10(guesses) scaled so that 10^14 guesses or more is 100.
+const double LOG10_GUESSES_FOR_FULL_SCORE = 14;
+const double LOG10_GUESSES_MODERATE = 6;
+const double LOG10_GUESSES_STRONG = 10;
+
+struct AnalysisResult {
+    Strength strength = Strength::Weak;
+    int score = 0;              // 0-100
+    double log10Guesses = 0;
+    bool breached = false;      // the whole password is a dictionary word
+    uint32_t suggestions = 0;
+    RunReport runs;
+    size_t matchCount = 0;      // every match found; only the first few are kept
+    PatternMatch matches[MAX_REPORTED_MATCHES];
+};
+
+struct AnalyzerScratch {
+    string lower;
+    vector<PatternMatch> found;     // --engine per-pattern collects here, then sorts
+};
+
+inline thread_local AnalyzerScratch t_scratch;
+
+inline void analyzePassword(string_view pass, const PatternIndex& index, AnalysisResult& out) {
+    StageTimer timer(STAGE_CHECKS);
+    uint32_t suggestions = 0;
+
+    // Length check
+    if (pass.length() < 8) suggestions |= SUGGEST_LENGTH;
+
+    // Character variety and triple repeats, one vector pass
+    CharProfile profile = profileChars(pass);
+    if (!(profile.classes & CLASS_UPPER)) suggestions |= SUGGEST_UPPER;
+    if (!(profile.classes & CLASS_LOWER)) suggestions |= SUGGEST_LOWER;
+    if (!(profile.classes & CLASS_DIGIT)) suggestions |= SUGGEST_DIGIT;
+    if (!(profile.classes & CLASS_SYMBOL)) suggestions |= SUGGEST_SYMBOL;
+    timer.lap(STAGE_CHECKS);
+
+    // Repeated chars, sequences and keyboard walks
+    out.runs = scanRuns(pass);
+    bool hasRepeat = profile.hasTriple;
+    bool hasSequence = out.runs.sequence.length >= MIN_SEQUENCE_RUN;
+    bool hasKeyboard = out.runs.keyboard.length >= MIN_KEYBOARD_RUN;
+    if (hasRepeat) suggestions |= SUGGEST_NO_REPEAT;
+    if (hasSequence) suggestions |= SUGGEST_NO_SEQUENCE;
+    if (hasKeyboard) suggestions |= SUGGEST_NO_KEYBOARD;
+    timer.lap(STAGE_RUNS);
+
+    // Weak pattern detection (Aho-Corasick over the static or loaded pattern automaton)
+    string& lowerPass = t_scratch.lower;
+    lowerPass.assign(pass.data(), pass.size());
+    for (char& c : lowerPass) c = (char)asciiLower((uint8_t)c);
+    out.matchCount = 0;
+    auto record = [&](const PatternMatch& m) {
+        if (out.matchCount < MAX_REPORTED_MATCHES) out.matches[out.matchCount] = m;
+        out.matchCount++;
+    };
+    if (g_matchEngine == MatchEngine::AhoCorasick) {
+        if (index.defaultPatterns) DEFAULT_WEAK_PATTERN_AUTOMATON.scan(lowerPass, record);
+        else index.trie.scan(lowerPass, record);
+    } else {
+        // Report in the automaton's order: by end position, longest first at the same end
+        vector<PatternMatch>& found = t_scratch.found;
+        found.clear();
+        for (size_t p = 0; p < index.compiled.size(); p++) {
+            const CompiledPattern& pattern = index.compiled[p];
+            for (size_t at = pattern.find(lowerPass); at != string::npos; at = pattern.find(lowerPass, at + 1))
+                found.push_back(PatternMatch{index.compiledIds[p], at, pattern.text().length()});
+        }
+        sort(found.begin(), found.end(), [](const PatternMatch& a, const PatternMatch& b) {
+            size_t endA = a.start + a.length, endB = b.start + b.length;
+            return endA != endB ? endA < endB : a.length > b.length;
+        });
+        for (const PatternMatch& m : found) record(m);
+    }
+    if (index.dictionary) index.dictionary->scan(lowerPass, record);
+
+    if (out.matchCount) suggestions |= SUGGEST_NO_WEAK_PATTERN;
+    timer.lap(STAGE_PATTERNS);
+
+    // Strength from the estimated number of guesses
+    GuessEstimate estimate = estimateGuesses(pass, lowerPass, out.matches,
+                                             min(out.matchCount, MAX_REPORTED_MATCHES),
+                                             index.dictionary ? index.dictionary->wordCount() : 0);
+    if (estimate.kinds & ((1u << KIND_DICTIONARY) | (1u << KIND_LEET))) suggestions |= SUGGEST_NO_COMMON_WORD;
+    if (estimate.kinds & (1u << KIND_DATE)) suggestions |= SUGGEST_NO_DATE;
+
+    // A breached password is found within one pass over the list, so it is weak whatever it looks like
+    out.breached = index.dictionary && index.dictionary->contains(lowerPass);
+    if (out.breached) {
+        suggestions |= SUGGEST_NOT_BREACHED;
+        estimate.log10Guesses = min(estimate.log10Guesses, log10(max<double>(index.dictionary->wordCount(), 1)));
+    }
+    out.log10Guesses = estimate.log10Guesses;
+    out.score = (int)lround(min(100.0, 100.0 * estimate.log10Guesses / LOG10_GUESSES_FOR_FULL_SCORE));
+    if (out.breached || estimate.log10Guesses < LOG10_GUESSES_MODERATE) out.strength = Strength::Weak;
+    else if (estimate.log10Guesses < LOG10_GUESSES_STRONG) out.strength = Strength::Moderate;
+    else out.strength = Strength::Strong;
+    out.suggestions = suggestions;
+    timer.lap(STAGE_ESTIMATE);
+}
+
+inline void analyzePassword(string_view pass, AnalysisResult& out) {
+    analyzePassword(pass, *currentPatternIndex(), out);
+}
+
+/* =====================================================
+   RESULT CACHE
+   Optional (--cache-mb) cache in front of analyzePassword
+   for the repeated inputs that keystroke-driven UIs and
+   batch jobs send. Entries are keyed by SipHash-2-4 of
+   the password under a random per-process key, so no
+   plaintext is stored. The key also mixes in the index
+   generation, so after a reload stale entries simply
+   stop matching and age out. Shards are picked by the
+   top bits of the hash and each has its own lock, a
+   fixed slot array evicted by CLOCK, and a linear-probing
+   table of slot numbers.
+   ===================================================== */
+
+const size_t CACHE_SHARDS = 64;
+const size_t CACHED_MATCHES = 3;       // results with more matches aren't cached
+
+inline uint64_t rotl64(uint64_t x, int n) { return (x << n) | (x >> (64 - n)); }
+
+struct SipKey {
+    uint64_t k0, k1;
+};
+
+inline uint64_t sipHash24(const SipKey& key, string_view data) {
+    uint64_t v0 = 0x736f6d6570736575ull ^ key.k0, v1 = 0x646f72616e646f6dull ^ key.k1;
+    uint64_t v2 = 0x6c7967656e657261ull ^ key.k0, v3 = 0x7465646279746573ull ^ key.k1;
+    auto round = [&] {
+        v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);
+        v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);
+    };
+    const uint8_t* p = (const uint8_t*)data.data();
+    size_t n = data.size(), full = n & ~(size_t)7;
+    for (size_t i = 0; i < full; i += 8) {
+        uint64_t m = 0;
+        for (int j = 0; j < 8; j++) m |= (uint64_t)p[i + j] << (8 * j);
+        v3 ^= m;
+        round(); round();
+        v0 ^= m;
+    }
+    uint64_t last = (uint64_t)n << 56;
+    for (size_t j = 0; j < n - full; j++) last |= (uint64_t)p[full + j] << (8 * j);
+    v3 ^= last;
+    round(); round();
+    v0 ^= last;
+    v2 ^= 0xff;
+    round(); round(); round(); round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+struct CacheStats {
+    size_t capacity = 0, entries = 0;
+    uint64_t hits = 0, misses = 0;
+};
+
+class ResultCache {
+private:
+    // Match offsets and kind, which is all a response reports of a match.
+    struct PackedMatch {
+        uint16_t start;
+        uint8_t length;
+        uint8_t dictionary;
+    };
+
+    // The fields of an AnalysisResult that a response needs.
+    struct Slot {
+        uint64_t key;
+        double log10Guesses;
+        uint32_t suggestions;
+        uint8_t strength, score, breached;
+        uint8_t referenced;     // CLOCK bit, set on every hit
+        uint8_t matchCount;
+        PackedMatch matches[CACHED_MATCHES];
+    };
+
+    struct Shard {
+        mutex lock;
+        vector<Slot> slots;
+        vector<uint32_t> table;     // slot index + 1, 0 = empty
+        size_t used = 0, hand = 0;
+        uint64_t hits = 0, misses = 0;
+
+        size_t home(uint64_t key) const { return key & (table.size() - 1); }
+
+        // Table position holding key, or the empty position where it would go.
+        size_t probe(uint64_t key) const {
+            size_t i = home(key);
+            while (table[i] && slots[table[i] - 1].key != key) i = (i + 1) & (table.size() - 1);
+            return i;
+        }
+
+        // Backward-shift deletion keeps every probe chain unbroken without tombstones.
+        void erase(size_t i) {
+            size_t mask = table.size() - 1;
+            for (size_t j = (i + 1) & mask; table[j]; j = (j + 1) & mask) {
+                size_t k = home(slots[table[j] - 1].key);
+                if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+                    table[i] = table[j];
+                    i = j;
+                }
+            }
+            table[i] = 0;
+        }
+    };
+
+    SipKey key;
+    Shard shards[CACHE_SHARDS];
+
+    uint64_t keyFor(string_view pass, uint64_t generation) const {
+        return sipHash24(SipKey{key.k0, key.k1 ^ generation}, pass);
+    }
+
+    Shard& shardFor(uint64_t k) { return shards[k >> 58]; }     // 64 shards = top 6 bits
+
+public:
+    explicit ResultCache(size_t budgetBytes) {
+        random_device seed;
+        key = {(uint64_t)seed() << 32 | seed(), (uint64_t)seed() << 32 | seed()};
+        size_t perShard = max<size_t>(1, budgetBytes / CACHE_SHARDS / (sizeof(Slot) + 4 * sizeof(uint32_t)));
+        size_t tableSize = 1;
+        while (tableSize < 2 * perShard) tableSize *= 2;
+        for (Shard& s : shards) {
+            s.slots.resize(perShard);
+            s.table.assign(tableSize, 0);
+        }
+    }
+
+    /* On a hit fills the response fields of out. Runs are left empty, and
+       a match keeps only its kind: patternId is 0 for a weak pattern and
+       -1 for a dictionary word. */
+    bool lookup(string_view pass, uint64_t generation, AnalysisResult& out) {
+        uint64_t k = keyFor(pass, generation);
+        Shard& s = shardFor(k);
+        lock_guard<mutex> guard(s.lock);
+        uint32_t at = s.table[s.probe(k)];
+        if (!at) { s.misses++; return false; }
+        Slot& slot = s.slots[at - 1];
+        slot.referenced = 1;
+        s.hits++;
+        out.strength = (Strength)slot.strength;
+        out.score = slot.score;
+        out.log10Guesses = slot.log10Guesses;
+        out.breached = slot.breached;
+        out.suggestions = slot.suggestions;
+        out.runs = RunReport();
+        out.matchCount = slot.matchCount;
+        for (size_t i = 0; i < slot.matchCount; i++) {
+            const PackedMatch& m = slot.matches[i];
+            out.matches[i] = PatternMatch{m.dictionary ? -1 : 0, m.start, m.length};
+        }
+        return true;
+    }
+
+    void store(string_view pass, uint64_t generation, const AnalysisResult& result) {
+        if (result.matchCount > CACHED_MATCHES || pass.size() > UINT16_MAX) return;
+        Slot fresh = {0, result.log10Guesses, result.suggestions, (uint8_t)result.strength,
+                      (uint8_t)result.score, (uint8_t)result.breached, 0, (uint8_t)result.matchCount, {}};
+        for (size_t i = 0; i < result.matchCount; i++) {
+            const PatternMatch& m = result.matches[i];
+            fresh.matches[i] = PackedMatch{(uint16_t)m.start, (uint8_t)m.length, (uint8_t)(m.patternId < 0)};
+        }
+        uint64_t k = fresh.key = keyFor(pass, generation);
+        Shard& s = shardFor(k);
+        lock_guard<mutex> guard(s.lock);
+        size_t pos = s.probe(k);
+        if (s.table[pos]) return;       // another thread got here first
+        size_t victim;
+        if (s.used < s.slots.size()) {
+            victim = s.used++;
+        } else {
+            while (s.slots[s.hand].referenced) {
+                s.slots[s.hand].referenced = 0;
+                s.hand = (s.hand + 1) % s.slots.size();
+            }
+            victim = s.hand;
+            s.hand = (s.hand + 1) % s.slots.size();
+            s.erase(s.probe(s.slots[victim].key));
+            pos = s.probe(k);       // the shift may have moved the empty position
+        }
+        s.slots[victim] = fresh;
+        s.table[pos] = (uint32_t)victim + 1;
+    }
+
+    CacheStats stats() {
+        CacheStats total;
+        for (Shard& s : shards) {
+            lock_guard<mutex> guard(s.lock);
+            total.capacity += s.slots.size();
+            total.entries += s.used;
+            total.hits += s.hits;
+            total.misses += s.misses;
+        }
+        return total;
+    }
+};
+
+inline unique_ptr<ResultCache> g_resultCache;      // null unless --cache-mb is given
+
+inline void analyzePasswordCached(string_view pass, const PatternIndex& index, AnalysisResult& out) {
+    bump(threadMetrics().passwords);
+    if (!g_resultCache) { analyzePassword(pass, index, out); return; }
+    if (g_resultCache->lookup(pass, index.generation, out)) return;
+    analyzePassword(pass, index, out);
+    g_resultCache->store(pass, index.generation, out);
+}
+
+/* =====================================================
+   JSON WRITER
+   Appends JSON straight into a caller's buffer, so a
+   response is built in place with no temporary strings.
+   Separators are placed automatically. Strings are
+   escaped per RFC 8259: quote, backslash and control
+   characters; other bytes are copied through, so UTF-8
+   text stays as it is. Numbers go through to_chars and
+   don't depend on the locale.
+   ===================================================== */
+
+class JsonWriter {
+private:
+    string& out;
+    bool needComma = false;     // a value was just completed at the current level
+
+    void separate() {
+        if (needComma) out += ", ";
+    }
+
+    void appendString(string_view s) {
+        static const char HEX[] = "0123456789abcdef";
+        out += '"';
+        size_t run = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            uint8_t c = (uint8_t)s[i];
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            out.append(s.data() + run, i - run);
+            run = i + 1;
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+                out += "\\u00";
+                out += HEX[c >> 4];
+                out += HEX[c & 15];
+            }
+        }
+        out.append(s.data() + run, s.size() - run);
+        out += '"';
+    }
+
+public:
+    explicit JsonWriter(string& buffer) : out(buffer) {}
+
+    JsonWriter& beginObject() { separate(); out += '{'; needComma = false; return *this; }
+    JsonWriter& endObject() { out += needComma ? " }" : "}"; needComma = true; return *this; }
+    JsonWriter& beginArray() { separate(); out += '['; needComma = false; return *this; }
+    JsonWriter& endArray() { out += ']'; needComma = true; return *this; }
+
+    JsonWriter& key(string_view name) {
+        out += needComma ? ", " : " ";
+        appendString(name);
+        out += ": ";
+        needComma = false;
+        return *this;
+    }
+
+    JsonWriter& value(string_view s) { separate(); appendString(s); needComma = true; return *this; }
+    JsonWriter& value(const char* s) { return value(string_view(s)); }
+    JsonWriter& value(bool b) { separate(); out += b ? "true" : "false"; needComma = true; return *this; }
+
+    template <typename T, enable_if_t<is_integral_v<T> && !is_same_v<T, bool>, int> = 0>
+    JsonWriter& value(T n) {
+        char digits[24];
+        separate();
+        out.append(digits, to_chars(digits, digits + sizeof(digits), n).ptr);
+        needComma = true;
+        return *this;
+    }
+
+    // Fixed notation with the given number of decimals, like printf's %.Nf.
+    JsonWriter& value(double d, int decimals) {
+        char digits[352];   // fits any finite double in fixed notation
+        separate();
+        if (!isfinite(d)) out += "null";
+        else out.append(digits, to_chars(digits, digits + sizeof(digits), d, chars_format::fixed, decimals).ptr);
+        needComma = true;
+        return *this;
+    }
+
+    template <typename T>
+    JsonWriter& field(string_view name, const T& v) { return key(name).value(v); }
+    JsonWriter& field(string_view name, double d, int decimals) { return key(name).value(d, decimals); }
+};
+
+inline void appendResultJson(string& out, const AnalysisResult& result) {
+    JsonWriter json(out);
+    json.beginObject()
+        .field("strength", strengthName(result.strength))
+        .field("score", result.score)
+        .field("guessesLog10", result.log10Guesses, 2)
+        .field("breached", result.breached);
+    json.key("suggestions").beginArray();
+    for (int i = 0; i < SUGGESTION_COUNT; i++)
+        if (result.suggestions & (1u << i)) json.value(SUGGESTION_TEXT[i]);
+    json.endArray();
+    json.key("matches").beginArray();
+    for (size_t i = 0; i < min(result.matchCount, MAX_REPORTED_MATCHES); i++) {
+        const PatternMatch& m = result.matches[i];
+        json.beginObject()
+            .field("start", m.start)
+            .field("length", m.length)
+            .field("source", m.patternId < 0 ? "dictionary" : "pattern")
+            .endObject();
+    }
+    json.endArray();
+    json.endObject();
+}
+
+// { "error": message }, escaped.
+inline void appendJsonError(string& out, string_view message) {
+    JsonWriter(out).beginObject().field("error", message).endObject();
+}
@@ -1,189 +1,2314 @@
-#include <iostream>
-#include <string>
-#include <vector>
-#include <regex>
-#include <algorithm>
-#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+
+// httplib reads this macro at its listen() call, so --backlog can set it at runtime.
+static int g_listenBacklog = 512;
+#define CPPHTTPLIB_LISTEN_BACKLOG g_listenBacklog
 #include "httplib.h"
 
+#include "analyzer.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+#ifdef __linux__
+#include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 using namespace std;
 
 /* =====================================================
-   TRIE DATA STRUCTURE FOR WEAK PATTERN STORAGE
+   BATCH ANALYSIS
+   A batch body is either a JSON array of strings or one
+   password per line. Work runs on the work-stealing
+   executor in chunks, and each chunk serializes its
+   results into its own buffer, so the output keeps the
+   input order whichever worker ran the chunk.
    ===================================================== */
 
-struct TrieNode {
-    TrieNode* children[26];
-    bool isEnd;
+const size_t MAX_BATCH_SIZE = 1000000;
+const size_t MIN_PARALLEL_BATCH = 256;
+
+size_t g_workerThreads = max<size_t>(1, thread::hardware_concurrency());
 
-    TrieNode() {
-        isEnd = false;
-        for (int i = 0; i < 26; i++)
-            children[i] = nullptr;
+void appendUtf8(string& out, uint32_t cp) {
+    if (cp < 0x80) out += (char)cp;
+    else if (cp < 0x800) { out += (char)(0xc0 | (cp >> 6)); out += (char)(0x80 | (cp & 0x3f)); }
+    else if (cp < 0x10000) {
+        out += (char)(0xe0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
+    } else {
+        out += (char)(0xf0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3f));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
     }
-};
+}
+
+bool parseHex4(const string& s, size_t pos, uint32_t& value) {
+    if (pos + 4 > s.size()) return false;
+    value = 0;
+    for (size_t i = pos; i < pos + 4; i++) {
+        char c = s[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+// Parses the JSON string starting at s[i] (the opening quote) and leaves i past it.
+bool parseJsonString(const string& s, size_t& i, string& value, string& error) {
+    if (i >= s.size() || s[i] != '"') { error = "expected string at offset " + to_string(i); return false; }
+    i++;
+    while (true) {
+        if (i >= s.size()) { error = "unterminated string"; return false; }
+        char c = s[i++];
+        if (c == '"') return true;
+        if (c != '\\') { value += c; continue; }
+        if (i >= s.size()) { error = "unterminated escape"; return false; }
+        char e = s[i++];
+        switch (e) {
+        case '"': value += '"'; break;
+        case '\\': value += '\\'; break;
+        case '/': value += '/'; break;
+        case 'b': value += '\b'; break;
+        case 'f': value += '\f'; break;
+        case 'n': value += '\n'; break;
+        case 'r': value += '\r'; break;
+        case 't': value += '\t'; break;
+        case 'u': {
+            uint32_t cp;
+            if (!parseHex4(s, i, cp)) { error = "bad \\u escape"; return false; }
+            i += 4;
+            uint32_t low;
+            if (cp >= 0xd800 && cp < 0xdc00 && s.compare(i, 2, "\\u") == 0 &&
+                parseHex4(s, i + 2, low) && low >= 0xdc00 && low < 0xe000) {
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                i += 6;
+            }
+            appendUtf8(value, cp);
+            break;
+        }
+        default: error = "bad escape"; return false;
+        }
+    }
+}
+
+// Parses a JSON array of strings; anything else in the array is an error.
+bool parseJsonStringArray(const string& s, vector<string>& out, string& error) {
+    size_t i = 0;
+    auto skipSpace = [&]() { while (i < s.size() && isspace((unsigned char)s[i])) i++; };
+    skipSpace();
+    if (i >= s.size() || s[i] != '[') { error = "expected '['"; return false; }
+    i++;
+    skipSpace();
+    if (i < s.size() && s[i] == ']') return true;
+    while (true) {
+        skipSpace();
+        string value;
+        if (!parseJsonString(s, i, value, error)) return false;
+        out.push_back(move(value));
+        if (out.size() > MAX_BATCH_SIZE) { error = "too many passwords"; return false; }
+        skipSpace();
+        if (i < s.size() && s[i] == ',') { i++; continue; }
+        if (i < s.size() && s[i] == ']') { i++; break; }
+        error = "expected ',' or ']'";
+        return false;
+    }
+    skipSpace();
+    if (i != s.size()) { error = "trailing data after array"; return false; }
+    return true;
+}
+
+bool parseBatchBody(const string& body, vector<string>& out, string& error) {
+    size_t first = body.find_first_not_of(" \t\r\n");
+    if (first != string::npos && body[first] == '[') return parseJsonStringArray(body, out, error);
+    for (size_t pos = 0; pos < body.size();) {
+        size_t end = body.find('\n', pos);
+        if (end == string::npos) end = body.size();
+        size_t len = end - pos;
+        if (len > 0 && body[pos + len - 1] == '\r') len--;
+        if (len > 0) out.emplace_back(body, pos, len);
+        if (out.size() > MAX_BATCH_SIZE) { error = "too many passwords"; return false; }
+        pos = end + 1;
+    }
+    return true;
+}
 
-class Trie {
+/* =====================================================
+   WORK-STEALING EXECUTOR
+   Persistent workers shared by the batch, streaming and
+   CLI modes. A job is a range of chunk indices split
+   evenly across per-worker queues; each worker takes its
+   own chunks front to back and, when it runs dry, steals
+   the back half of another worker's remaining range, so
+   a few long passwords can't leave cores idle at the
+   tail. Jobs from concurrent callers share the queues,
+   which hand out one chunk of each queued job in turn,
+   so a huge batch slows a small one down instead of
+   holding it up. A caller works on its own job as
+   worker 0 until every chunk has been taken.
+   ===================================================== */
+
+class WorkStealingExecutor {
 private:
-    TrieNode* root;
+    struct Job {
+        const function<void(size_t, size_t)>* fn;
+        atomic<size_t> unfinished;          // chunks not yet done
+    };
+
+    struct Range {
+        Job* job;
+        size_t next, end;                   // chunks [next, end) not yet started
+    };
+
+    struct alignas(64) WorkerQueue {
+        mutex lock;
+        deque<Range> ranges;
+    };
+
+    size_t workers;
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> helpers;
+    mutex stateLock;
+    condition_variable jobReady, jobDone;
+    uint64_t generation = 0;                // bumped whenever a job is queued
+    bool stopping = false;
+
+    // Next chunk from the front range, which then goes to the back so the queue's jobs take turns.
+    static bool takeFront(WorkerQueue& queue, Job*& job, size_t& chunk) {
+        if (queue.ranges.empty()) return false;
+        Range r = queue.ranges.front();
+        queue.ranges.pop_front();
+        job = r.job;
+        chunk = r.next++;
+        if (r.next < r.end) queue.ranges.push_back(r);
+        return true;
+    }
+
+    bool take(size_t self, Job*& job, size_t& chunk) {
+        WorkerQueue& own = *queues[self];
+        {
+            lock_guard<mutex> guard(own.lock);
+            if (takeFront(own, job, chunk)) return true;
+        }
+        for (size_t k = 1; k < workers; k++) {
+            WorkerQueue& victim = *queues[(self + k) % workers];
+            Range stolen;
+            {
+                lock_guard<mutex> guard(victim.lock);
+                if (victim.ranges.empty()) continue;
+                Range& r = victim.ranges.back();      // the newest job first
+                size_t left = r.end - r.next;
+                stolen = {r.job, r.end - (left + 1) / 2, r.end};
+                r.end = stolen.next;
+                if (r.next == r.end) victim.ranges.pop_back();
+            }
+            // Other jobs may have been queued here meanwhile; the stolen range waits its turn behind them
+            lock_guard<mutex> guard(own.lock);
+            own.ranges.push_back(stolen);
+            return takeFront(own, job, chunk);
+        }
+        return false;
+    }
+
+    // A chunk of job from the back of any range, for its caller; other jobs' ranges are skipped.
+    bool takeOwn(Job* job, size_t& chunk) {
+        for (auto& queue : queues) {
+            lock_guard<mutex> guard(queue->lock);
+            for (auto it = queue->ranges.begin(); it != queue->ranges.end(); ++it) {
+                if (it->job != job) continue;
+                chunk = --it->end;
+                if (it->next == it->end) queue->ranges.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void finish(Job* job, size_t chunk, size_t worker) {
+        (*job->fn)(chunk, worker);
+        if (job->unfinished.fetch_sub(1, memory_order_acq_rel) == 1) {
+            lock_guard<mutex> guard(stateLock);
+            jobDone.notify_all();
+        }
+    }
+
+    void helperLoop(size_t self) {
+        for (;;) {
+            uint64_t seen;
+            {
+                lock_guard<mutex> guard(stateLock);
+                seen = generation;
+            }
+            Job* job;
+            size_t chunk;
+            while (take(self, job, chunk)) finish(job, chunk, self);
+            unique_lock<mutex> guard(stateLock);
+            jobReady.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+        }
+    }
 
 public:
-    Trie() { root = new TrieNode(); }
+    explicit WorkStealingExecutor(size_t workerCount) : workers(max<size_t>(1, workerCount)) {
+        for (size_t w = 0; w < workers; w++) queues.emplace_back(new WorkerQueue());
+        for (size_t w = 1; w < workers; w++) helpers.emplace_back([this, w] { helperLoop(w); });
+    }
 
-    void insert(const string& word) {
-        TrieNode* curr = root;
-        for (char c : word) {
-            int idx = c - 'a';
-            if (!curr->children[idx])
-                curr->children[idx] = new TrieNode();
-            curr = curr->children[idx];
+    ~WorkStealingExecutor() {
+        {
+            lock_guard<mutex> guard(stateLock);
+            stopping = true;
         }
-        curr->isEnd = true;
+        jobReady.notify_all();
+        for (thread& t : helpers) t.join();
     }
 
-    bool search(const string& word) {
-        TrieNode* curr = root;
-        for (char c : word) {
-            int idx = c - 'a';
-            if (!curr->children[idx])
-                return false;
-            curr = curr->children[idx];
+    size_t workerCount() const { return workers; }
+
+    // Calls fn(chunk, worker) once for every chunk in [0, chunks) and returns when all are done.
+    void run(size_t chunks, const function<void(size_t, size_t)>& fn) {
+        if (!chunks) return;
+        Job job{&fn, {chunks}};
+        for (size_t w = 0; w < workers; w++) {
+            Range r{&job, chunks * w / workers, chunks * (w + 1) / workers};
+            if (r.next == r.end) continue;
+            lock_guard<mutex> guard(queues[w]->lock);
+            queues[w]->ranges.push_back(r);
+        }
+        {
+            lock_guard<mutex> guard(stateLock);
+            generation++;
         }
-        return curr->isEnd;
+        jobReady.notify_all();
+        size_t chunk;
+        while (takeOwn(&job, chunk)) finish(&job, chunk, 0);
+        unique_lock<mutex> guard(stateLock);
+        jobDone.wait(guard, [&] { return job.unfinished.load(memory_order_acquire) == 0; });
+    }
+};
+
+WorkStealingExecutor& executor() {
+    static WorkStealingExecutor instance(g_workerThreads);     // after --threads is parsed
+    return instance;
+}
+
+const size_t MIN_CHUNK = 64;
+const size_t MAX_CHUNK = 4096;
+const size_t CHUNKS_PER_WORKER = 8;
+
+// Chunk size for count items: enough chunks per worker to balance, few enough to stay cheap.
+size_t chunkSizeFor(size_t count) {
+    size_t target = count / (executor().workerCount() * CHUNKS_PER_WORKER);
+    return min(MAX_CHUNK, max(MIN_CHUNK, target));
+}
+
+size_t chunkCountFor(size_t count) {
+    size_t size = chunkSizeFor(count);
+    return (count + size - 1) / size;
+}
+
+/* Calls fn(chunk, begin, end, worker) for the chunkCountFor(count)
+   chunks of [0, count). Small inputs run inline on the caller as
+   one chunk on worker 0. */
+void parallelFor(size_t count, const function<void(size_t, size_t, size_t, size_t)>& fn) {
+    if (count < MIN_PARALLEL_BATCH) {
+        if (count) fn(0, 0, count, 0);
+        return;
     }
+    size_t size = chunkSizeFor(count);
+    executor().run(chunkCountFor(count), [&](size_t chunk, size_t worker) {
+        size_t begin = chunk * size;
+        fn(chunk, begin, min(count, begin + size), worker);
+    });
+}
+
+size_t parallelChunks(size_t count) { return count < MIN_PARALLEL_BATCH ? 1 : chunkCountFor(count); }
+
+size_t parallelWorkers() { return executor().workerCount(); }
+
+// Appends results for every password to out, in order, joined by separator.
+void analyzeBatch(const vector<string>& passwords, const char* separator, string& out) {
+    auto index = currentPatternIndex();
+    size_t chunks = parallelChunks(passwords.size());
+    vector<string> parts(chunks > 1 ? chunks : 0);     // a single chunk writes straight into out
+    parallelFor(passwords.size(), [&](size_t chunk, size_t begin, size_t end, size_t) {
+        string& buffer = parts.empty() ? out : parts[chunk];
+        buffer.reserve(buffer.size() + (end - begin) * 160);
+        AnalysisResult result;
+        for (size_t i = begin; i < end; i++) {
+            if (i) buffer += separator;
+            analyzePasswordCached(passwords[i], *index, result);
+            StageTimer timer(STAGE_JSON);
+            appendResultJson(buffer, result);
+            timer.lap(STAGE_JSON);
+        }
+    });
+    size_t total = out.size();
+    for (auto& part : parts) total += part.size();
+    out.reserve(total);
+    for (auto& part : parts) out += part;
+}
+
+/* =====================================================
+   BINARY FRAMES (POST /analyze/binary)
+   For internal callers that send many passwords at once
+   and don't want form decoding or JSON. All integers are
+   little-endian.
+
+     request   "PWQ1"  u32 count  count x { u16 length, bytes }
+     response  "PWR1"  u32 count  count x 16-byte BinaryRecord
+
+   Records come back in request order. Since they are fixed
+   size, each chunk writes its own slice of the response
+   and nothing is joined afterwards. Passwords are read in
+   place from the request body.
+   ===================================================== */
+
+const char* const FRAME_CONTENT_TYPE = "application/x-pw-frame";
+const char FRAME_REQUEST_MAGIC[4] = {'P', 'W', 'Q', '1'};
+const char FRAME_RESPONSE_MAGIC[4] = {'P', 'W', 'R', '1'};
+const size_t FRAME_HEADER_SIZE = 8;
+
+enum BinaryFlags : uint8_t { RECORD_BREACHED = 1, RECORD_DICTIONARY_MATCH = 2 };
+
+struct BinaryRecord {
+    uint8_t strength;           // Strength: 0 weak, 1 moderate, 2 strong
+    uint8_t score;              // 0-100
+    uint8_t flags;              // BinaryFlags
+    uint8_t matchCount;         // saturates at 255
+    uint32_t suggestions;       // SUGGEST_* bits
+    uint32_t guessesLog10x100;  // log10(guesses), fixed point with two decimals
+    uint16_t firstMatchStart;   // valid when matchCount > 0
+    uint8_t firstMatchLength;
+    uint8_t reserved;
 };
+static_assert(sizeof(BinaryRecord) == 16, "BinaryRecord is part of the wire format");
+
+uint32_t readLE32(const char* p) {
+    const uint8_t* b = (const uint8_t*)p;
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+void writeLE(char* p, uint32_t v, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) p[i] = (char)(v >> (8 * i));
+}
+
+void writeRecord(char* p, const AnalysisResult& result) {
+    writeLE(p, (uint8_t)result.strength, 1);
+    writeLE(p + 1, (uint32_t)result.score, 1);
+    bool dictionary = result.matchCount && result.matches[0].patternId < 0;
+    writeLE(p + 2, (result.breached ? RECORD_BREACHED : 0) | (dictionary ? RECORD_DICTIONARY_MATCH : 0), 1);
+    writeLE(p + 3, (uint32_t)min<size_t>(result.matchCount, 255), 1);
+    writeLE(p + 4, result.suggestions, 4);
+    writeLE(p + 8, (uint32_t)llround(max(0.0, result.log10Guesses) * 100), 4);
+    uint32_t start = result.matchCount ? (uint32_t)min<size_t>(result.matches[0].start, UINT16_MAX) : 0;
+    uint32_t length = result.matchCount ? (uint32_t)min<size_t>(result.matches[0].length, 255) : 0;
+    writeLE(p + 12, start, 2);
+    writeLE(p + 14, length, 1);
+    p[15] = 0;
+}
+
+// Splits a request frame into views over body.
+bool parseFrame(const string& body, vector<string_view>& out, string& error) {
+    if (body.size() < FRAME_HEADER_SIZE || memcmp(body.data(), FRAME_REQUEST_MAGIC, 4) != 0) {
+        error = "expected a PWQ1 frame";
+        return false;
+    }
+    uint32_t count = readLE32(body.data() + 4);
+    if (count > MAX_BATCH_SIZE) { error = "too many passwords"; return false; }
+    // Every entry takes at least its two-byte length
+    if (count > (body.size() - FRAME_HEADER_SIZE) / 2) { error = "frame shorter than its count"; return false; }
+    out.reserve(count);
+    size_t pos = FRAME_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        if (body.size() - pos < 2) { error = "truncated length at entry " + to_string(i); return false; }
+        size_t length = (uint8_t)body[pos] | ((uint8_t)body[pos + 1] << 8);
+        pos += 2;
+        if (body.size() - pos < length) { error = "truncated password at entry " + to_string(i); return false; }
+        out.emplace_back(body.data() + pos, length);
+        pos += length;
+    }
+    if (pos != body.size()) { error = "trailing data after frame"; return false; }
+    return true;
+}
+
+// Appends a response frame for every password to out.
+void analyzeFrame(const vector<string_view>& passwords, string& out) {
+    size_t base = out.size();
+    out.resize(base + FRAME_HEADER_SIZE + passwords.size() * sizeof(BinaryRecord));
+    memcpy(&out[base], FRAME_RESPONSE_MAGIC, 4);
+    writeLE(&out[base + 4], (uint32_t)passwords.size(), 4);
+    char* records = &out[base + FRAME_HEADER_SIZE];
+    auto index = currentPatternIndex();
+    parallelFor(passwords.size(), [&](size_t, size_t begin, size_t end, size_t) {
+        AnalysisResult result;
+        for (size_t i = begin; i < end; i++) {
+            analyzePasswordCached(passwords[i], *index, result);
+            writeRecord(records + i * sizeof(BinaryRecord), result);
+        }
+    });
+}
 
 /* =====================================================
-   BRUTE FORCE STRING MATCHING
+   RESPONSE COMPRESSION
+   Uses httplib's gzip and brotli support, which is off
+   unless the build turns it on:
+
+     -DCPPHTTPLIB_ZLIB_SUPPORT -lz
+     -DCPPHTTPLIB_BROTLI_SUPPORT -lbrotlienc -lbrotlidec
+
+   httplib would compress any body whose bare Content-Type
+   is on its list, whatever the size, and its negotiation
+   ignores q=0. Analysis responses are sent as JSON_TYPE,
+   which carries a parameter and so is never on the list,
+   and compressed here instead: batch bodies only from
+   COMPRESS_MIN_BYTES up, since below that the framing and
+   CPU cost more than they save, and the NDJSON stream
+   chunk by chunk, so its memory stays flat. Single
+   /analyze results are always under the threshold.
    ===================================================== */
-bool bruteForceMatch(const string& text, const string& pattern) {
-    int n = text.length();
-    int m = pattern.length();
-    for (int i = 0; i <= n - m; i++) {
-        int j = 0;
-        while (j < m && text[i + j] == pattern[j]) j++;
-        if (j == m) return true;
+
+const size_t COMPRESS_MIN_BYTES = 1024;
+const char* const JSON_TYPE = "application/json; charset=utf-8";
+
+// Case-insensitive match against a lowercase header name or token.
+bool headerIs(string_view a, const char* b) {
+    size_t n = strlen(b);
+    if (a.size() != n) return false;
+    for (size_t i = 0; i < n; i++)
+        if (asciiLower((uint8_t)a[i]) != (uint8_t)b[i]) return false;
+    return true;
+}
+
+// True if Accept-Encoding lists coding with a nonzero q.
+bool acceptsEncoding(const string& acceptEncoding, const char* coding) {
+    for (size_t pos = 0; pos < acceptEncoding.size();) {
+        size_t end = min(acceptEncoding.find(',', pos), acceptEncoding.size());
+        string_view item(acceptEncoding.data() + pos, end - pos);
+        pos = end + 1;
+        size_t semi = min(item.find(';'), item.size());
+        string_view name = item.substr(0, semi), params = item.substr(semi);
+        while (!name.empty() && name.front() == ' ') name.remove_prefix(1);
+        while (!name.empty() && name.back() == ' ') name.remove_suffix(1);
+        if (!headerIs(name, coding)) continue;
+        size_t q = params.find("q=");
+        return q == string_view::npos || strtod(string(params.substr(q + 2)).c_str(), nullptr) > 0;
     }
     return false;
 }
 
+// The compressor for the best coding the client accepts (br before gzip, as httplib
+// prefers), or null; coding is set to its Content-Encoding name.
+unique_ptr<httplib::detail::compressor> compressorFor(const httplib::Request& req, const char*& coding) {
+    const string& accept = req.get_header_value("Accept-Encoding");
+    (void)accept;
+    coding = nullptr;
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+    if (acceptsEncoding(accept, "br")) {
+        coding = "br";
+        return make_unique<httplib::detail::brotli_compressor>();
+    }
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+    if (acceptsEncoding(accept, "gzip")) {
+        coding = "gzip";
+        return make_unique<httplib::detail::gzip_compressor>();
+    }
+#endif
+    return nullptr;
+}
+
+// Compresses res.body in place when it is large enough and the client accepts it.
+void compressBody(const httplib::Request& req, httplib::Response& res) {
+    res.set_header("Vary", "Accept-Encoding");
+    const char* coding = nullptr;
+    auto compressor = res.body.size() >= COMPRESS_MIN_BYTES ? compressorFor(req, coding) : nullptr;
+    if (!compressor) return;
+    string compressed;
+    compressed.reserve(res.body.size() / 8);
+    bool ok = compressor->compress(res.body.data(), res.body.size(), true, [&](const char* data, size_t len) {
+        compressed.append(data, len);
+        return true;
+    });
+    if (!ok) return;
+    res.body.swap(compressed);
+    res.set_header("Content-Encoding", coding);
+}
+
+/* =====================================================
+   STREAMING ANALYSIS (NDJSON)
+   Each line of the body is a password, either raw or as
+   a JSON string. Lines are analyzed as soon as the chunk
+   that completes them arrives and the results go out as
+   NDJSON over chunked transfer encoding, so memory is
+   bounded by one receive chunk plus one partial line.
+   With a compressor, output is compressed as it goes;
+   the compressor holds back what it hasn't framed yet
+   until more output or the end of the stream.
+   ===================================================== */
+
+const size_t MAX_STREAM_LINE = 4096;
+
+class StreamAnalyzer {
+private:
+    httplib::DataSink& sink;
+    httplib::detail::compressor* compressor;    // null to send NDJSON as is
+    string partial;
+    bool overflow = false;      // current line exceeded MAX_STREAM_LINE
+    vector<string> lines;
+    string out;
+
+    void addLine(string line) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) return;
+        if (line[0] == '"') {
+            size_t i = 0;
+            string value, error;
+            if (parseJsonString(line, i, value, error)) line = move(value);
+        }
+        lines.push_back(move(line));
+    }
+
+public:
+    size_t bytesIn = 0, bytesOut = 0, rejected = 0;     // for the request metrics
+
+    StreamAnalyzer(httplib::DataSink& s, httplib::detail::compressor* c = nullptr) : sink(s), compressor(c) {}
+
+    bool feed(const char* data, size_t len) {
+        bytesIn += len;
+        for (size_t pos = 0; pos < len;) {
+            const char* nl = (const char*)memchr(data + pos, '\n', len - pos);
+            size_t end = nl ? (size_t)(nl - data) : len;
+            if (!overflow) {
+                partial.append(data + pos, end - pos);
+                if (partial.size() > MAX_STREAM_LINE) {
+                    overflow = true;
+                    partial.clear();
+                }
+            }
+            if (!nl) break;
+            if (overflow) {
+                analyzePending();   // keep the error in input order
+                out += "{ \"error\": \"line too long\" }\n";
+                rejected++;
+                overflow = false;
+            } else {
+                addLine(move(partial));
+                partial.clear();
+            }
+            pos = end + 1;
+        }
+        return flush();
+    }
+
+    bool finish() {
+        if (overflow) {
+            analyzePending();
+            out += "{ \"error\": \"line too long\" }\n";
+            rejected++;
+        }
+        else addLine(move(partial));
+        partial.clear();
+        return flush(true);
+    }
+
+    void analyzePending() {
+        if (lines.empty()) return;
+        analyzeBatch(lines, "\n", out);
+        out += "\n";
+        lines.clear();
+    }
+
+    // last ends the compressed stream, so it goes out even with nothing new.
+    bool flush(bool last = false) {
+        analyzePending();
+        if (out.empty() && !(compressor && last)) return true;
+        // Counted as it reaches the sink, so compressed streams report what went on the wire
+        auto send = [this](const char* data, size_t len) {
+            bytesOut += len;
+            return sink.write(data, len);
+        };
+        bool ok = compressor ? compressor->compress(out.data(), out.size(), last, send) : send(out.data(), out.size());
+        out.clear();
+        return ok && sink.is_writable();
+    }
+};
+
 /* =====================================================
-   KMP STRING MATCHING
+   OFFLINE BATCH MODE
+   `backend --file FILE` analyzes a file (or stdin for
+   "-") without HTTP. Input is read in blocks of lines;
+   the next block is read while the current one is being
+   analyzed across the worker threads, and results are
+   written in input order.
    ===================================================== */
-vector<int> computeLPS(const string& pattern) {
-    int m = pattern.length();
-    vector<int> lps(m, 0);
-    for (int i = 1, len = 0; i < m;) {
-        if (pattern[i] == pattern[len]) lps[i++] = ++len;
-        else if (len != 0) len = lps[len - 1];
-        else lps[i++] = 0;
+
+const size_t CLI_BLOCK_LINES = 65536;
+
+bool readBlock(istream& in, vector<string>& block) {
+    block.clear();
+    string line;
+    while (block.size() < CLI_BLOCK_LINES && getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) block.push_back(move(line));
     }
-    return lps;
+    return !block.empty();
 }
 
-bool KMPMatch(const string& text, const string& pattern) {
-    vector<int> lps = computeLPS(pattern);
-    int i = 0, j = 0;
-    while (i < text.length()) {
-        if (text[i] == pattern[j]) { i++; j++; }
-        if (j == pattern.length()) return true;
-        else if (i < text.length() && text[i] != pattern[j]) {
-            if (j != 0) j = lps[j - 1];
-            else i++;
+int cliCommand(const string& path, bool statsOnly) {
+    ios::sync_with_stdio(false);
+    ifstream file;
+    istream* in = &cin;
+    if (path != "-") {
+        file.open(path, ios::binary);
+        if (!file) { cerr << "Cannot open " << path << "\n"; return 1; }
+        in = &file;
+    }
+
+    auto started = chrono::steady_clock::now();
+    size_t total = 0;
+    size_t counts[3] = {0, 0, 0};
+    vector<string> current, next;
+    string out;     // reused across blocks
+    bool more = readBlock(*in, current);
+    while (more) {
+        auto reader = async(launch::async, [&] { return readBlock(*in, next); });
+        if (statsOnly) {
+            auto index = currentPatternIndex();
+            vector<array<size_t, 3>> perWorker(parallelWorkers(), array<size_t, 3>{0, 0, 0});
+            parallelFor(current.size(), [&](size_t, size_t begin, size_t end, size_t worker) {
+                AnalysisResult result;
+                size_t local[3] = {0, 0, 0};
+                for (size_t i = begin; i < end; i++) {
+                    analyzePasswordCached(current[i], *index, result);
+                    local[(int)result.strength]++;
+                }
+                for (int s = 0; s < 3; s++) perWorker[worker][s] += local[s];
+            });
+            for (auto& c : perWorker)
+                for (int s = 0; s < 3; s++) counts[s] += c[s];
+        } else {
+            out.clear();
+            analyzeBatch(current, "\n", out);
+            out += "\n";
+            cout.write(out.data(), out.size());
         }
+        total += current.size();
+        more = reader.get();
+        swap(current, next);
+    }
+    cout.flush();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    ostream& report = statsOnly ? cout : cerr;
+    report << fixed << setprecision(1);
+    if (statsOnly) {
+        const char* names[3] = {"weak", "moderate", "strong"};
+        report << "passwords: " << total << "\n";
+        for (int s = 0; s < 3; s++)
+            report << names[s] << ": " << counts[s] << " ("
+                   << (total ? 100.0 * counts[s] / total : 0.0) << "%)\n";
     }
+    if (g_resultCache) {
+        CacheStats cache = g_resultCache->stats();
+        uint64_t lookups = cache.hits + cache.misses;
+        report << "cache: " << cache.hits << " hits, " << cache.misses << " misses ("
+               << (lookups ? 100.0 * cache.hits / lookups : 0.0) << "% hit rate)\n";
+    }
+    report << "elapsed: " << setprecision(3) << seconds << " s, " << setprecision(0)
+           << (seconds > 0 ? total / seconds : 0.0) << " passwords/s on "
+           << g_workerThreads << " threads\n";
+    return 0;
+}
+
+/* =====================================================
+   HTTP WORKER POOL
+   Replaces httplib's default pool so the worker count is
+   a runtime setting, and each worker can be pinned to its
+   own core (round-robin) to keep its caches and the
+   thread-local scratch warm. With a queue bound, jobs
+   past it go to one overflow thread instead, which only
+   answers 503 (see admitRequest), so a flood gets a fast
+   refusal rather than a growing wait.
+   ===================================================== */
+
+bool pinCurrentThread(size_t core) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) != 0;
+#else
+    (void)core;
     return false;
+#endif
 }
 
+thread_local bool t_overflowLane = false;   // this thread answers only with 503
+
+class WorkerPool : public httplib::TaskQueue {
+private:
+    struct Job {
+        function<void()> fn;
+        uint64_t queuedAt;
+    };
+
+    vector<thread> threads;
+    deque<Job> jobs, overflow;
+    size_t maxQueue;                // 0 = unbounded, and no overflow thread
+    mutex lock;
+    condition_variable ready, overflowReady;
+    bool stopping = false;
+
+    void run(deque<Job>& queue, condition_variable& signal) {
+        for (;;) {
+            function<void()> job;
+            {
+                unique_lock<mutex> guard(lock);
+                signal.wait(guard, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;      // only when stopping
+                job = move(queue.front().fn);
+                queue.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+    WorkerPool(size_t count, bool pin, size_t queueBound = 0) : maxQueue(queueBound) {
+        size_t cores = max<size_t>(1, thread::hardware_concurrency());
+        for (size_t i = 0; i < count; i++)
+            threads.emplace_back([this, i, pin, cores] {
+                if (pin) pinCurrentThread(i % cores);
+                run(jobs, ready);
+            });
+        if (maxQueue)
+            threads.emplace_back([this] {
+                t_overflowLane = true;
+                run(overflow, overflowReady);
+            });
+    }
+
+    void enqueue(function<void()> fn) override {
+        bool full;
+        {
+            lock_guard<mutex> guard(lock);
+            full = maxQueue && jobs.size() >= maxQueue;
+            (full ? overflow : jobs).push_back({move(fn), nowNanos()});
+        }
+        (full ? overflowReady : ready).notify_one();
+    }
+
+    size_t queued() {
+        lock_guard<mutex> guard(lock);
+        return jobs.size();
+    }
+
+    // How long the oldest queued job has waited; 0 when a worker is free.
+    uint64_t queueDelayNanos() {
+        lock_guard<mutex> guard(lock);
+        return jobs.empty() ? 0 : nowNanos() - jobs.front().queuedAt;
+    }
+
+    void shutdown() override {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        overflowReady.notify_all();
+        for (thread& t : threads) t.join();
+    }
+};
+
 /* =====================================================
-   PASSWORD ANALYSIS (GREEDY HEURISTIC)
+   ABANDONED REQUESTS
+   The live UI cancels a request when the next keystroke
+   supersedes it, and the browser closes that connection.
+   By then the request may be queued or half-read, so the
+   handlers check the peer just before analyzing and drop
+   the work if it has gone. ClientAwareServer records the
+   socket each httplib worker is serving, as it isn't
+   reachable from a handler otherwise.
    ===================================================== */
 
-pair<string, string> analyzePassword(const string& pass) {
-    Trie trie;
-    vector<string> weakPatterns = {"password", "admin", "qwerty", "1234", "1111"};
-    for (auto w : weakPatterns) trie.insert(w);
-
-    int score = 0;
-    string suggestion = "";
-
-    // Length check
-    if (pass.length() >= 12) score += 2;
-    else if (pass.length() >= 8) score += 1;
-    else suggestion += "Use at least 8 characters. ";
-
-    // Character variety
-    bool up=false, low=false, dig=false, sym=false;
-    for (char c : pass) {
-        if (isupper(c)) up=true;
-        else if (islower(c)) low=true;
-        else if (isdigit(c)) dig=true;
-        else sym=true;
-    }
-    if(up) score++; else suggestion += "Add uppercase letters. ";
-    if(low) score++; else suggestion += "Add lowercase letters. ";
-    if(dig) score++; else suggestion += "Add numbers. ";
-    if(sym) score++; else suggestion += "Add symbols (#, @, !). ";
-
-    // Repeated chars
-    regex repeat("(.)\\1{2,}");
-    if (regex_search(pass, repeat)) suggestion += "Avoid repeating characters. ";
-    else score++;
-
-    // Weak pattern detection (Trie + Brute Force + KMP)
-    bool hasWeakPattern = false;
-    string lowerPass = pass;
-    transform(lowerPass.begin(), lowerPass.end(), lowerPass.begin(), ::tolower);
-
-    for (auto pattern : weakPatterns) {
-        if (trie.search(pattern) || bruteForceMatch(lowerPass, pattern) || KMPMatch(lowerPass, pattern)) {
-            hasWeakPattern = true;
-            break;
+thread_local socket_t t_clientSocket = INVALID_SOCKET;
+
+class ClientAwareServer : public httplib::Server {
+private:
+    // Server::process_and_close_socket, with the socket noted for clientGone()
+    // and one request per connection on the overflow lane
+    bool process_and_close_socket(socket_t sock) override {
+        t_clientSocket = sock;
+        // A refused client is told to close, so its next request queues afresh
+        size_t keepAliveMax = t_overflowLane ? 1 : keep_alive_max_count_;
+        bool ret = httplib::detail::process_server_socket(
+            svr_sock_, sock, keepAliveMax, keep_alive_timeout_sec_,
+            read_timeout_sec_, read_timeout_usec_, write_timeout_sec_, write_timeout_usec_,
+            [this](httplib::Stream& strm, bool closeConnection, bool& connectionClosed) {
+                return process_request(strm, closeConnection, connectionClosed, nullptr);
+            });
+        t_clientSocket = INVALID_SOCKET;
+        httplib::detail::shutdown_socket(sock);
+        httplib::detail::close_socket(sock);
+        return ret;
+    }
+};
+
+// True when the client of the current httplib request has closed its connection.
+bool clientGone() {
+    return t_clientSocket != INVALID_SOCKET && !httplib::detail::is_socket_alive(t_clientSocket);
+}
+
+/* =====================================================
+   SERVER CONFIGURATION
+   Every setting can be given as --name VALUE or as a
+   "name = value" line in a --config file; later settings
+   win, so flags after --config override the file.
+   ===================================================== */
+
+struct ServerConfig {
+    string host = "0.0.0.0";
+    int port = 5000;
+    size_t workers = max<size_t>(1, thread::hardware_concurrency());
+    bool pinThreads = false;
+    bool reactor = false;           // epoll event loop instead of httplib (Linux only)
+    size_t keepAliveMax = 100;
+    time_t keepAliveTimeout = 5;    // seconds
+    time_t readTimeout = 5;
+    time_t writeTimeout = 5;
+    size_t maxPayload = 0;          // bytes; 0 = unlimited, as /analyze/stream takes any size
+    size_t rateLimit = 0;           // tokens per second for each client IP; 0 = unlimited
+    size_t keyRateLimit = 0;        // the same for each X-API-Key; 0 = keyed requests use rateLimit
+    size_t rateBurst = 0;           // tokens a client can save up; 0 = one second's worth
+    size_t maxQueue = 0;            // jobs waiting for a worker before 503s; 0 = unbounded
+    size_t shedAfterMs = 0;         // queue delay at which bulk requests get 503s; 0 = never
+    string shard;                   // this node's name in ring; empty = it holds the whole range table
+    string ring;                    // comma-separated names of every shard
+    string shards;                  // router mode: comma-separated [name=]host:port of every shard
+    string adminToken;              // X-Admin-Token for /admin/*; empty = loopback clients only
+};
+
+// Decimal digits only: no sign or spaces, and nothing that overflows size_t.
+bool parseCount(const string& value, size_t& out) {
+    const char* end = value.data() + value.size();
+    size_t n = 0;
+    auto [ptr, ec] = from_chars(value.data(), end, n);
+    if (ec != errc() || ptr != end) return false;
+    out = n;
+    return true;
+}
+
+bool parseFlag(const string& value, bool& out) {
+    out = value == "true" || value == "1" || value == "yes";
+    return out || value == "false" || value == "0" || value == "no";
+}
+
+// Applies one setting; false if the name is unknown or the value is invalid.
+bool applyServerSetting(ServerConfig& config, const string& name, const string& value) {
+    size_t n = 0;
+    if (name == "host") { config.host = value; return !value.empty(); }
+    if (name == "pin-threads") return parseFlag(value, config.pinThreads);
+    if (name == "reactor") return parseFlag(value, config.reactor);
+    if (name == "shard") { config.shard = value; return !value.empty(); }
+    if (name == "ring") { config.ring = value; return !value.empty(); }
+    if (name == "shards") { config.shards = value; return !value.empty(); }
+    if (name == "admin-token") { config.adminToken = value; return !value.empty(); }
+    if (!parseCount(value, n)) return false;
+    if (name == "port" && n > 0 && n < 65536) config.port = (int)n;
+    else if (name == "workers" && n > 0) config.workers = n;
+    else if (name == "backlog" && n > 0 && n <= INT32_MAX) g_listenBacklog = (int)n;
+    else if (name == "keep-alive-max" && n > 0) config.keepAliveMax = n;
+    else if (name == "keep-alive-timeout") config.keepAliveTimeout = (time_t)n;
+    else if (name == "read-timeout") config.readTimeout = (time_t)n;
+    else if (name == "write-timeout") config.writeTimeout = (time_t)n;
+    else if (name == "max-payload") config.maxPayload = n;
+    else if (name == "rate-limit") config.rateLimit = n;
+    else if (name == "key-rate-limit") config.keyRateLimit = n;
+    else if (name == "rate-burst") config.rateBurst = n;
+    else if (name == "max-queue") config.maxQueue = n;
+    else if (name == "shed-after-ms") config.shedAfterMs = n;
+    else return false;
+    return true;
+}
+
+bool loadServerConfig(ServerConfig& config, const string& path, string& error) {
+    ifstream in(path);
+    if (!in) { error = "cannot open " + path; return false; }
+    string line;
+    for (int lineNo = 1; getline(in, line); lineNo++) {
+        size_t hash = line.find('#');
+        if (hash != string::npos) line.erase(hash);
+        auto trim = [](string s) {
+            size_t b = s.find_first_not_of(" \t\r"), e = s.find_last_not_of(" \t\r");
+            return b == string::npos ? string() : s.substr(b, e - b + 1);
+        };
+        line = trim(line);
+        if (line.empty()) continue;
+        size_t eq = line.find('=');
+        if (eq == string::npos || !applyServerSetting(config, trim(line.substr(0, eq)), trim(line.substr(eq + 1)))) {
+            error = path + ":" + to_string(lineNo) + ": invalid setting '" + line + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+/* =====================================================
+   ADMISSION CONTROL
+   Runs before any analysis, so a refusal costs almost
+   nothing. Every client IP has a token bucket, and a
+   request carrying X-API-Key also draws on that key's
+   bucket; keys aren't authenticated here, so they add a
+   limit and never lift the IP one. A request costs one
+   token per started 4 KiB of body, capped at the burst
+   size so any request can get through eventually; past
+   the limit it gets 429 with Retry-After. Under overload
+   the bulk endpoints are shed first, with a 503 once the
+   queue delay passes --shed-after-ms, which keeps
+   interactive /analyze latency down; past --max-queue
+   everything gets 503.
+   ===================================================== */
+
+const size_t RATE_COST_BYTES = 4096;
+const size_t RATE_LIMIT_SLOTS = 1 << 16;    // clients sharing a slot share its bucket
+
+/* A token bucket kept as one timestamp (GCRA): the time at
+   which the bucket would be full again. Taking n tokens
+   pushes it n intervals later, and a request is refused if
+   that lands more than a burst ahead of now, so each take
+   is a single CAS with no lock and no refill pass. */
+class RateLimiter {
+private:
+    unique_ptr<atomic<uint64_t>[]> fullAt;
+    uint64_t interval;              // nanoseconds per token
+    uint64_t burst;                 // tokens
+
+public:
+    RateLimiter(size_t perSecond, size_t burstTokens)
+        : fullAt(new atomic<uint64_t>[RATE_LIMIT_SLOTS]),
+          interval(1000000000ull / perSecond), burst(max<size_t>(1, burstTokens)) {
+        for (size_t i = 0; i < RATE_LIMIT_SLOTS; i++) fullAt[i].store(0, memory_order_relaxed);
+    }
+
+    // False if key's bucket lacks cost tokens; retryAfter is then the wait in nanoseconds.
+    bool take(string_view key, uint64_t cost, uint64_t& retryAfter) {
+        atomic<uint64_t>& slot = fullAt[hash<string_view>()(key) & (RATE_LIMIT_SLOTS - 1)];
+        uint64_t now = nowNanos(), seen = slot.load(memory_order_relaxed);
+        uint64_t charge = min(cost, burst) * interval, tolerance = burst * interval;
+        for (;;) {
+            uint64_t next = max(seen, now) + charge;
+            if (next - now > tolerance) {
+                retryAfter = next - now - tolerance;
+                return false;
+            }
+            if (slot.compare_exchange_weak(seen, next, memory_order_relaxed)) return true;
         }
     }
+};
 
-    if (hasWeakPattern) suggestion += "Remove common weak patterns like '1234'. ";
-    else score++;
+struct Admission {
+    int status = 200;               // 200 to go ahead, else 429 or 503
+    uint32_t retryAfter = 0;        // seconds
+};
 
-    // Strength
-    string strength;
-    if (score <= 3) strength = "Weak";
-    else if (score <= 6) strength = "Moderate";
-    else strength = "Strong";
+class AdmissionControl {
+private:
+    unique_ptr<RateLimiter> perIp, perKey;
+    size_t maxQueue = 0;
+    uint64_t shedAfter = 0;         // nanoseconds
+    string adminToken;
 
-    return {strength, suggestion};
+public:
+    atomic<WorkerPool*> pool{nullptr};     // the pool whose queue is watched
+
+    void configure(const ServerConfig& config) {
+        auto burstFor = [&](size_t rate) { return config.rateBurst ? config.rateBurst : rate; };
+        if (config.rateLimit) perIp = make_unique<RateLimiter>(config.rateLimit, burstFor(config.rateLimit));
+        if (config.keyRateLimit) perKey = make_unique<RateLimiter>(config.keyRateLimit, burstFor(config.keyRateLimit));
+        maxQueue = config.maxQueue;
+        shedAfter = (uint64_t)config.shedAfterMs * 1000000;
+        adminToken = config.adminToken;
+    }
+
+    // The admin token if one is configured (compared in constant time), else a loopback peer.
+    bool adminAllowed(string_view ip, string_view token) const {
+        if (adminToken.empty()) return ip.rfind("127.", 0) == 0 || ip == "::1" || ip.rfind("::ffff:127.", 0) == 0;
+        if (token.size() != adminToken.size()) return false;
+        uint8_t diff = 0;
+        for (size_t i = 0; i < token.size(); i++) diff |= (uint8_t)(token[i] ^ adminToken[i]);
+        return diff == 0;
+    }
+
+    Admission admit(Endpoint endpoint, string_view ip, string_view apiKey, size_t bodyBytes) {
+        Admission a;
+        WorkerPool* workers = pool.load(memory_order_acquire);
+        bool bulk = endpoint != ENDPOINT_ANALYZE;
+        if (t_overflowLane || (maxQueue && workers && workers->queued() >= maxQueue) ||
+            (bulk && shedAfter && workers && workers->queueDelayNanos() > shedAfter)) {
+            a.status = 503;
+            a.retryAfter = 1;
+            return a;
+        }
+        uint64_t cost = 1 + bodyBytes / RATE_COST_BYTES, wait = 0;
+        if ((perIp && !perIp->take(ip, cost, wait)) ||
+            (perKey && !apiKey.empty() && !perKey->take(apiKey, cost, wait))) {
+            a.status = 429;
+            a.retryAfter = (uint32_t)max<uint64_t>(1, (wait + 999999999) / 1000000000);
+        }
+        return a;
+    }
+};
+
+AdmissionControl g_admission;
+
+const char* refusalMessage(int status) { return status == 429 ? "rate limit exceeded" : "server overloaded"; }
+
+Admission admissionFor(const httplib::Request& req, Endpoint endpoint) {
+    return g_admission.admit(endpoint, req.remote_addr, req.get_header_value("X-API-Key"), req.body.size());
+}
+
+void refuseRequest(const Admission& a, httplib::Response& res, RequestMetrics& metrics) {
+    metrics.limited = a.status == 429;
+    metrics.shed = a.status == 503;
+    res.status = a.status;
+    res.set_header("Retry-After", to_string(a.retryAfter));
+    appendJsonError(res.body, refusalMessage(a.status));
+    res.set_header("Content-Type", "application/json");
+}
+
+// True if the request was refused, with the refusal already in res.
+bool refused(const httplib::Request& req, httplib::Response& res, RequestMetrics& metrics) {
+    Admission a = admissionFor(req, metrics.endpoint);
+    if (a.status == 200) return false;
+    refuseRequest(a, res, metrics);
+    return true;
+}
+
+// refused() plus the admin check; /admin/* can rebuild the index, so it isn't open to everyone.
+bool adminRefused(const httplib::Request& req, httplib::Response& res, RequestMetrics& metrics) {
+    if (refused(req, res, metrics)) return true;
+    if (g_admission.adminAllowed(req.remote_addr, req.get_header_value("X-Admin-Token"))) return false;
+    metrics.rejected = 1;
+    res.status = 403;
+    appendJsonError(res.body, "admin endpoints need a loopback client or X-Admin-Token");
+    res.set_header("Content-Type", "application/json");
+    return true;
 }
 
+/* =====================================================
+   BACKGROUND INDEX RELOAD
+   POST /admin/reload and SIGHUP only queue a rebuild;
+   one background thread builds and publishes it, so no
+   request waits on a reload. Requests that arrive while
+   a rebuild runs are coalesced into one more pass, which
+   picks up whatever files are newest by then.
+   ===================================================== */
+
+struct ReloadStatus {
+    bool pending = false;       // queued or running
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    double lastSeconds = 0;
+    string lastError;           // from the most recent failed pass
+};
+
+class IndexReloader {
+private:
+    mutex lock;
+    condition_variable wake;
+    bool requested = false;
+    ReloadStatus status_;
+
+    void run() {
+        unique_lock<mutex> guard(lock);
+        for (;;) {
+            wake.wait(guard, [this] { return requested; });
+            requested = false;
+            guard.unlock();
+
+            auto started = chrono::steady_clock::now();
+            string error;
+            bool ok = reloadPatternIndex(error);     // returns once the old snapshot is freed
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+            guard.lock();
+            if (ok) status_.completed++;
+            else {
+                status_.failed++;
+                status_.lastError = error;
+                cerr << "Index reload failed, keeping the current index: " << error << "\n";
+            }
+            status_.lastSeconds = seconds;
+            status_.pending = requested;
+        }
+    }
+
+public:
+    IndexReloader() { thread([this] { run(); }).detach(); }
+
+    void request() {
+        {
+            lock_guard<mutex> guard(lock);
+            requested = status_.pending = true;
+        }
+        wake.notify_one();
+    }
+
+    ReloadStatus status() {
+        lock_guard<mutex> guard(lock);
+        return status_;
+    }
+};
+
+IndexReloader& indexReloader() {
+    static IndexReloader instance;
+    return instance;
+}
+
+string reloadStatusJson() {
+    ReloadStatus status = indexReloader().status();
+    auto index = currentPatternIndex();
+    size_t words = index->dictionary ? index->dictionary->wordCount() : 0;
+    uint64_t hashes = index->ranges ? index->ranges->hashCount() : 0;
+    string out;
+    JsonWriter json(out);
+    json.beginObject()
+        .field("pending", status.pending)
+        .field("completed", status.completed)
+        .field("failed", status.failed)
+        .field("lastSeconds", status.lastSeconds, 3);
+    if (!status.lastError.empty()) json.field("lastError", status.lastError);
+    json.field("generation", index->generation)
+        .field("patterns", index->patterns.size())
+        .field("skippedPatterns", index->skippedPatterns)
+        .field("dictionaryWords", words)
+        .field("rangeHashes", hashes)
+        .endObject();
+    return out;
+}
+
+#ifndef _WIN32
+// Blocks SIGHUP here and in every thread started later, then waits for it on a thread of its own.
+void reloadOnSighup() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    thread([set] {
+        for (int sig; sigwait(&set, &sig) == 0;) indexReloader().request();
+    }).detach();
+}
+#endif
+
+/* =====================================================
+   SHARED REQUEST HANDLERS
+   Response bodies for the analysis endpoints, used by
+   both the httplib server and the epoll reactor.
+   ===================================================== */
+
+const char* PASSWORD_REQUIRED_JSON = "{ \"strength\": \"N/A\", \"suggestions\": [\"Password required.\"] }";
+const size_t ANALYZE_JSON_RESERVE = 1024;   // fits a result with every suggestion and several matches
+
+// Appends the result for password to out.
+void analyzeOneJson(string_view password, string& out) {
+    AnalysisResult result;
+    analyzePasswordCached(password, *currentPatternIndex(), result);
+    StageTimer timer(STAGE_JSON);
+    out.reserve(out.size() + ANALYZE_JSON_RESERVE);
+    appendResultJson(out, result);
+    timer.lap(STAGE_JSON);
+}
+
+// Appends the response body to out and returns the HTTP status.
+int analyzeBatchJson(const string& body, string& out) {
+    vector<string> passwords;
+    string error;
+    if (!parseBatchBody(body, passwords, error)) {
+        appendJsonError(out, error);
+        return 400;
+    }
+    out += '[';
+    analyzeBatch(passwords, ", ", out);
+    out += ']';
+    return 200;
+}
+
+// Appends a response frame, or a JSON error, to out and returns the HTTP status.
+int analyzeFrameBody(const string& body, string& out) {
+    vector<string_view> passwords;
+    string error;
+    if (!parseFrame(body, passwords, error)) {
+        appendJsonError(out, error);
+        return 400;
+    }
+    analyzeFrame(passwords, out);
+    return 200;
+}
+
+void appendMetricHeader(string& out, const char* name, const char* type, const char* help) {
+    out += "# HELP "; out += name; out += ' '; out += help; out += '\n';
+    out += "# TYPE "; out += name; out += ' '; out += type; out += '\n';
+}
+
+void appendSample(string& out, const char* name, const string& labels, double value) {
+    char number[32];
+    snprintf(number, sizeof(number), "%.17g", value);
+    out += name;
+    if (!labels.empty()) { out += '{'; out += labels; out += '}'; }
+    out += ' '; out += number; out += '\n';
+}
+
+// Merged per-label histograms from every shard, as Prometheus buckets in seconds.
+template <typename F>
+void appendHistograms(string& out, const char* name, const char* help, const char* label,
+                      const char* const* names, size_t count, F histogramOf) {
+    appendMetricHeader(out, name, "histogram", help);
+    string bucketName = string(name) + "_bucket", sumName = string(name) + "_sum", countName = string(name) + "_count";
+    for (size_t k = 0; k < count; k++) {
+        uint64_t buckets[HISTOGRAM_BUCKETS + 1] = {}, total = 0, sum = 0;
+        {
+            lock_guard<mutex> guard(g_metricsLock);
+            for (const auto& shard : g_metricsShards) {
+                const Histogram& h = histogramOf(*shard, k);
+                for (int i = 0; i <= HISTOGRAM_BUCKETS; i++) buckets[i] += h.buckets[i].load(memory_order_relaxed);
+                total += h.count.load(memory_order_relaxed);
+                sum += h.sumNanos.load(memory_order_relaxed);
+            }
+        }
+        string base = string(label) + "=\"" + names[k] + "\"";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            cumulative += buckets[i];
+            char le[32];
+            snprintf(le, sizeof(le), "%g", histogramBound(i) * 1e-9);
+            appendSample(out, bucketName.c_str(), base + ",le=\"" + le + "\"", (double)cumulative);
+        }
+        appendSample(out, bucketName.c_str(), base + ",le=\"+Inf\"", (double)total);
+        appendSample(out, sumName.c_str(), base, sum * 1e-9);
+        appendSample(out, countName.c_str(), base, (double)total);
+    }
+}
+
+uint64_t sumCounter(MetricCounter MetricsShard::*field) {
+    lock_guard<mutex> guard(g_metricsLock);
+    uint64_t total = 0;
+    for (const auto& shard : g_metricsShards) total += (shard.get()->*field).load(memory_order_relaxed);
+    return total;
+}
+
+uint64_t sumEndpointCounter(MetricCounter (MetricsShard::*field)[ENDPOINT_COUNT], size_t endpoint) {
+    lock_guard<mutex> guard(g_metricsLock);
+    uint64_t total = 0;
+    for (const auto& shard : g_metricsShards) total += (shard.get()->*field)[endpoint].load(memory_order_relaxed);
+    return total;
+}
+
+string renderMetrics() {
+    string out;
+    struct { const char* name; const char* help; MetricCounter (MetricsShard::*field)[ENDPOINT_COUNT]; } perEndpoint[] = {
+        {"pw_requests_total", "Requests handled.", &MetricsShard::requests},
+        {"pw_rejected_inputs_total", "Inputs rejected as missing or malformed.", &MetricsShard::rejected},
+        {"pw_abandoned_requests_total", "Requests dropped because the client disconnected first.", &MetricsShard::abandoned},
+        {"pw_rate_limited_total", "Requests refused with 429 by a client rate limit.", &MetricsShard::limited},
+        {"pw_shed_requests_total", "Requests refused with 503 under overload.", &MetricsShard::shed},
+        {"pw_received_bytes_total", "Request body bytes received.", &MetricsShard::bytesIn},
+        {"pw_sent_bytes_total", "Response body bytes sent.", &MetricsShard::bytesOut},
+    };
+    for (const auto& metric : perEndpoint) {
+        appendMetricHeader(out, metric.name, "counter", metric.help);
+        for (size_t e = 0; e < ENDPOINT_COUNT; e++)
+            appendSample(out, metric.name, string("endpoint=\"") + ENDPOINT_NAMES[e] + "\"",
+                         (double)sumEndpointCounter(metric.field, e));
+    }
+    appendMetricHeader(out, "pw_passwords_analyzed_total", "counter", "Passwords analyzed, including cache hits.");
+    appendSample(out, "pw_passwords_analyzed_total", "", (double)sumCounter(&MetricsShard::passwords));
+    if (g_resultCache) {
+        CacheStats cache = g_resultCache->stats();
+        appendMetricHeader(out, "pw_cache_hits_total", "counter", "Result cache hits.");
+        appendSample(out, "pw_cache_hits_total", "", (double)cache.hits);
+        appendMetricHeader(out, "pw_cache_misses_total", "counter", "Result cache misses.");
+        appendSample(out, "pw_cache_misses_total", "", (double)cache.misses);
+        appendMetricHeader(out, "pw_cache_entries", "gauge", "Entries in the result cache.");
+        appendSample(out, "pw_cache_entries", "", (double)cache.entries);
+    }
+    appendHistograms(out, "pw_request_duration_seconds", "Time from request start to response body.", "endpoint",
+                     ENDPOINT_NAMES, ENDPOINT_COUNT,
+                     [](const MetricsShard& s, size_t k) -> const Histogram& { return s.requestLatency[k]; });
+    appendHistograms(out, "pw_stage_duration_seconds", "Time per analysis stage, sampled.", "stage",
+                     STAGE_NAMES, STAGE_COUNT,
+                     [](const MetricsShard& s, size_t k) -> const Histogram& { return s.stages[k]; });
+    return out;
+}
+
+/* =====================================================
+   SHARDED BREACH LOOKUP
+   POST /breach/batch takes SHA-1 hashes, one hex digest
+   per line, and answers a JSON array with how often each
+   one appears in the range table. A node holds either
+   the whole table or, with the shard and ring settings
+   and a table from --build-range --shard, only the
+   prefixes the ring gives it, so memory per node shrinks
+   with the cluster. A router (the shards setting) holds
+   no table: it splits each batch by the same ring, asks
+   the shards in parallel over kept-alive connections and
+   merges their answers back into request order, and
+   forwards /range/{prefix} to the prefix's owner. Rate
+   limits belong on the router, since every request a
+   shard sees comes from it.
+   ===================================================== */
+
+HashRing g_shardRing;
+int g_shardIndex = -1;          // this node's shard in g_shardRing; -1 when it holds the whole table
+
+bool ownsPrefix(uint32_t prefix) {
+    return g_shardIndex < 0 || g_shardRing.ownerOf(prefix) == (size_t)g_shardIndex;
+}
+
+bool parseHashList(const string& body, vector<Sha1Digest>& out, string& error) {
+    for (size_t pos = 0; pos < body.size();) {
+        size_t end = body.find('\n', pos);
+        if (end == string::npos) end = body.size();
+        size_t len = end - pos;
+        if (len > 0 && body[pos + len - 1] == '\r') len--;
+        if (len > 0) {
+            Sha1Digest digest;
+            if (len != 40 || !parseSha1Hex(string_view(body.data() + pos, len), digest.bytes)) {
+                error = "expected one SHA-1 hex digest per line";
+                return false;
+            }
+            out.push_back(digest);
+        }
+        if (out.size() > MAX_BATCH_SIZE) { error = "too many hashes"; return false; }
+        pos = end + 1;
+    }
+    return true;
+}
+
+void appendSha1Hex(string& out, const Sha1Digest& digest) {
+    for (uint8_t b : digest.bytes) {
+        out += RANGE_HEX[b >> 4];
+        out += RANGE_HEX[b & 0xf];
+    }
+}
+
+class BreachRouter {
+private:
+    struct Shard {
+        string host;
+        int port = 0;
+        mutex lock;
+        vector<unique_ptr<httplib::Client>> idle;   // connections kept alive between requests
+    };
+
+    HashRing ring;
+    vector<unique_ptr<Shard>> shards;       // indexed like the ring
+    time_t timeout = 5;                     // seconds
+
+    unique_ptr<httplib::Client> connect(Shard& shard) {
+        {
+            lock_guard<mutex> guard(shard.lock);
+            if (!shard.idle.empty()) {
+                unique_ptr<httplib::Client> client = move(shard.idle.back());
+                shard.idle.pop_back();
+                return client;
+            }
+        }
+        auto client = make_unique<httplib::Client>(shard.host, shard.port);
+        client->set_keep_alive(true);
+        client->set_connection_timeout(timeout, 0);
+        client->set_read_timeout(timeout, 0);
+        client->set_write_timeout(timeout, 0);
+        return client;
+    }
+
+    // Only called after a clean response; a failed connection is dropped instead.
+    void release(Shard& shard, unique_ptr<httplib::Client> client) {
+        lock_guard<mutex> guard(shard.lock);
+        shard.idle.push_back(move(client));
+    }
+
+    // Looks up hashes[positions] on shard s into counts[positions]; returns an error, or "".
+    string askShard(size_t s, const vector<Sha1Digest>& hashes, const vector<size_t>& positions,
+                    vector<uint32_t>& counts) {
+        string body;
+        body.reserve(positions.size() * 41);
+        for (size_t i : positions) {
+            appendSha1Hex(body, hashes[i]);
+            body += '\n';
+        }
+        unique_ptr<httplib::Client> client = connect(*shards[s]);
+        httplib::Result r = client->Post("/breach/batch", body, "text/plain");
+        if (!r) return "shard " + ring.name(s) + " unreachable";
+        if (r->status != 200) return "shard " + ring.name(s) + " answered " + to_string(r->status);
+        const char* p = r->body.c_str();
+        size_t found = 0;
+        if (*p == '[') {
+            for (p++; found < positions.size(); found++) {
+                while (*p == ' ' || *p == ',') p++;
+                char* end = nullptr;
+                unsigned long n = strtoul(p, &end, 10);
+                if (end == p) break;
+                counts[positions[found]] = (uint32_t)n;
+                p = end;
+            }
+        }
+        if (found != positions.size()) return "shard " + ring.name(s) + " sent a malformed answer";
+        release(*shards[s], move(client));
+        return "";
+    }
+
+public:
+    // spec is the shards setting; a shard without a name is named by its address.
+    bool configure(const string& spec, time_t timeoutSeconds, string& error) {
+        timeout = timeoutSeconds;
+        vector<pair<string, string>> entries;      // name, host:port
+        string names;
+        for (size_t pos = 0; pos <= spec.size();) {
+            size_t end = min(spec.find(',', pos), spec.size());
+            string entry = spec.substr(pos, end - pos);
+            pos = end + 1;
+            entry.erase(remove(entry.begin(), entry.end(), ' '), entry.end());
+            if (entry.empty()) continue;
+            size_t eq = entry.find('=');
+            string address = eq == string::npos ? entry : entry.substr(eq + 1);
+            entries.emplace_back(eq == string::npos ? entry : entry.substr(0, eq), address);
+            names += entries.back().first + ",";
+        }
+        if (!ring.parse(names, error)) return false;
+        shards.resize(ring.size());
+        for (const auto& [name, address] : entries) {
+            auto shard = make_unique<Shard>();
+            size_t colon = address.rfind(':');
+            size_t port = 0;
+            if (colon == string::npos || colon == 0 || !parseCount(address.substr(colon + 1), port) ||
+                port == 0 || port > 65535) {
+                error = "shard " + name + " needs a host:port address";
+                return false;
+            }
+            shard->host = address.substr(0, colon);
+            shard->port = (int)port;
+            shards[ring.find(name)] = move(shard);
+        }
+        return true;
+    }
+
+    size_t size() const { return shards.size(); }
+
+    bool lookup(const vector<Sha1Digest>& hashes, vector<uint32_t>& counts, string& error) {
+        vector<vector<size_t>> positions(shards.size());
+        for (size_t i = 0; i < hashes.size(); i++) positions[ring.ownerOf(rangePrefix(hashes[i].bytes))].push_back(i);
+        vector<size_t> asked;
+        for (size_t s = 0; s < shards.size(); s++)
+            if (!positions[s].empty()) asked.push_back(s);
+        if (asked.empty()) return true;
+
+        // Waiting on the network would stall the analysis executor, so every shard
+        // but the last gets a thread of its own and the last is asked from here
+        vector<future<string>> pending;
+        for (size_t k = 0; k + 1 < asked.size(); k++)
+            pending.push_back(async(launch::async, [&, s = asked[k]] { return askShard(s, hashes, positions[s], counts); }));
+        error = askShard(asked.back(), hashes, positions[asked.back()], counts);
+        for (auto& f : pending) {
+            string e = f.get();
+            if (error.empty()) error = e;
+        }
+        return error.empty();
+    }
+
+    // Answers a /range request with the owning shard's response.
+    void forwardRange(uint32_t prefix, const httplib::Request& req, httplib::Response& res) {
+        size_t s = ring.ownerOf(prefix);
+        char path[16];
+        snprintf(path, sizeof(path), "/range/%05X", prefix);
+        httplib::Headers headers;
+        if (req.has_header("If-None-Match")) headers.emplace("If-None-Match", req.get_header_value("If-None-Match"));
+        unique_ptr<httplib::Client> client = connect(*shards[s]);
+        httplib::Result r = client->Get(path, headers);
+        if (!r) {
+            res.status = 502;
+            appendJsonError(res.body, "shard " + ring.name(s) + " unreachable");
+            res.set_header("Content-Type", "application/json");
+            return;
+        }
+        res.status = r->status;
+        for (const char* name : {"Content-Type", "Cache-Control", "ETag"})
+            if (r->has_header(name)) res.set_header(name, r->get_header_value(name));
+        res.body = move(r->body);
+        release(*shards[s], move(client));
+    }
+};
+
+unique_ptr<BreachRouter> g_router;      // set in router mode
+
+// Checks the shard, ring and shards settings and sets this node's role from them.
+bool configureCluster(const ServerConfig& config, string& error) {
+    bool router = !config.shards.empty(), shard = !config.shard.empty() || !config.ring.empty();
+    if ((router || shard) && config.reactor) { error = "the reactor does not serve breach lookups"; return false; }
+    if (router && shard) { error = "a router cannot also be a shard"; return false; }
+    if (router) {
+        g_router = make_unique<BreachRouter>();
+        return g_router->configure(config.shards, config.readTimeout, error);
+    }
+    if (!shard) return true;
+    if (config.shard.empty() || config.ring.empty()) { error = "shard and ring must be set together"; return false; }
+    if (!g_shardRing.parse(config.ring, error)) return false;
+    g_shardIndex = g_shardRing.find(config.shard);
+    if (g_shardIndex < 0) { error = "shard " + config.shard + " is not in the ring"; return false; }
+    g_rangeShardId = g_shardRing.shardId(g_shardIndex);
+    return true;
+}
+
+// Appends the breach counts, or a JSON error, to out and returns the HTTP status.
+int breachBatchBody(const string& body, string& out) {
+    vector<Sha1Digest> hashes;
+    string error;
+    if (!parseHashList(body, hashes, error)) {
+        appendJsonError(out, error);
+        return 400;
+    }
+    vector<uint32_t> counts(hashes.size(), 0);
+    if (g_router) {
+        if (!g_router->lookup(hashes, counts, error)) {
+            appendJsonError(out, error);
+            return 502;
+        }
+    } else {
+        auto index = currentPatternIndex();
+        if (!index->ranges) {
+            appendJsonError(out, "no range table loaded");
+            return 404;
+        }
+        for (const Sha1Digest& digest : hashes)
+            if (!ownsPrefix(rangePrefix(digest.bytes))) {
+                appendJsonError(out, "hash not held by this shard");
+                return 421;
+            }
+        const RangeTable& table = *index->ranges;
+        parallelFor(hashes.size(), [&](size_t, size_t begin, size_t end, size_t) {
+            for (size_t i = begin; i < end; i++) counts[i] = table.count(hashes[i]);
+        });
+    }
+    JsonWriter json(out);
+    json.beginArray();
+    for (uint32_t n : counts) json.value(n);
+    json.endArray();
+    return 200;
+}
+
+/* =====================================================
+   EPOLL REACTOR SERVER (--reactor, Linux only)
+   One thread owns every socket through an edge-triggered
+   epoll set and only parses and writes; complete
+   requests go to the worker pool, which posts finished
+   responses back through an eventfd. An idle keep-alive
+   connection costs a buffer and a map entry instead of a
+   parked thread, so slow clients can't starve fast ones.
+   Serves the analysis endpoints and /metrics; the
+   streaming, range and admin endpoints stay on the
+   threaded server.
+   ===================================================== */
+
+#ifdef __linux__
+
+const size_t REACTOR_MAX_HEADER = 16 * 1024;
+const size_t REACTOR_DEFAULT_MAX_BODY = 64 * 1024 * 1024;     // when --max-payload is unlimited
+const size_t REACTOR_READ_CHUNK = 64 * 1024;
+const int REACTOR_MAX_EVENTS = 256;
+const uint64_t REACTOR_LISTEN_ID = 0, REACTOR_WAKE_ID = 1;
+
+const char* httpStatusText(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Error";
+    }
+}
+
+string httpResponse(int status, const char* contentType, const string& body, bool keepAlive,
+                    uint32_t retryAfter = 0) {
+    string out = "HTTP/1.1 " + to_string(status) + " " + httpStatusText(status) + "\r\n";
+    if (retryAfter) out += "Retry-After: " + to_string(retryAfter) + "\r\n";
+    out += "Access-Control-Allow-Origin: *\r\n"
+           "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
+           "Access-Control-Allow-Headers: Content-Type, X-API-Key\r\n";
+    if (contentType) { out += "Content-Type: "; out += contentType; out += "\r\n"; }
+    out += "Content-Length: " + to_string(body.size()) + "\r\n";
+    out += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    out += body;
+    return out;
+}
+
+class Reactor {
+private:
+    struct Connection {
+        int fd = -1;
+        string peer;                    // client IP, for rate limiting
+        string in, out;
+        size_t outSent = 0;
+        size_t served = 0;
+        bool busy = false;              // a request is with the worker pool
+        bool closeAfterWrite = false;
+        chrono::steady_clock::time_point lastActive;
+        shared_ptr<atomic<bool>> gone = make_shared<atomic<bool>>(false);   // read by the pool job
+    };
+
+    struct Completion {
+        uint64_t id;
+        string response;
+        bool close;
+    };
+
+    const ServerConfig& config;
+    size_t maxBody;
+    int epfd = -1, listenFd = -1, wakeFd = -1;
+    WorkerPool pool;
+    unordered_map<uint64_t, Connection> conns;
+    uint64_t nextId = REACTOR_WAKE_ID + 1;
+    mutex doneLock;
+    vector<Completion> done;
+
+    void closeConnection(uint64_t id) {
+        auto it = conns.find(id);
+        if (it == conns.end()) return;
+        it->second.gone->store(true, memory_order_relaxed);
+        ::close(it->second.fd);     // also drops it from the epoll set
+        conns.erase(it);
+    }
+
+    void acceptAll() {
+        for (;;) {
+            sockaddr_storage addr = {};
+            socklen_t addrLen = sizeof(addr);
+            int fd = accept4(listenFd, (sockaddr*)&addr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;     // EAGAIN, or a transient error we retry on the next event
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            uint64_t id = nextId++;
+            epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.u64 = id;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) { ::close(fd); continue; }
+            Connection& c = conns[id];
+            c.fd = fd;
+            char ip[INET6_ADDRSTRLEN] = "";
+            if (addr.ss_family == AF_INET)
+                inet_ntop(AF_INET, &((sockaddr_in*)&addr)->sin_addr, ip, sizeof(ip));
+            else if (addr.ss_family == AF_INET6)
+                inet_ntop(AF_INET6, &((sockaddr_in6*)&addr)->sin6_addr, ip, sizeof(ip));
+            c.peer = ip;
+            c.lastActive = chrono::steady_clock::now();
+        }
+    }
+
+    // Sends as much of c.out as the socket takes; false if the connection is gone.
+    bool flush(uint64_t id, Connection& c) {
+        while (c.outSent < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.outSent, c.out.size() - c.outSent, MSG_NOSIGNAL);
+            if (n > 0) { c.outSent += (size_t)n; continue; }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;   // wait for EPOLLOUT
+            closeConnection(id);
+            return false;
+        }
+        c.out.clear();
+        c.outSent = 0;
+        if (c.closeAfterWrite) { closeConnection(id); return false; }
+        return true;
+    }
+
+    void reply(Connection& c, int status, const char* contentType, const string& body, bool keepAlive,
+               uint32_t retryAfter = 0) {
+        c.closeAfterWrite = !keepAlive;
+        c.out += httpResponse(status, contentType, body, keepAlive, retryAfter);
+    }
+
+    /* Parses at most one complete request from c.in and either
+       answers it inline or hands it to the pool. Returns true
+       if it consumed one, so the caller can try the next. */
+    bool dispatch(uint64_t id, Connection& c) {
+        if (c.busy || c.closeAfterWrite) return false;
+        size_t headerEnd = c.in.find("\r\n\r\n");
+        if (headerEnd == string::npos) {
+            if (c.in.size() > REACTOR_MAX_HEADER) reply(c, 431, nullptr, "", false);
+            return false;
+        }
+        string_view head(c.in.data(), headerEnd);
+        size_t lineEnd = head.find("\r\n");
+        string_view requestLine = head.substr(0, lineEnd);
+        size_t sp1 = requestLine.find(' '), sp2 = requestLine.rfind(' ');
+        if (sp1 == string_view::npos || sp2 <= sp1) { reply(c, 400, nullptr, "", false); return false; }
+        string method(requestLine.substr(0, sp1));
+        string target(requestLine.substr(sp1 + 1, sp2 - sp1 - 1));
+        bool keepAlive = requestLine.substr(sp2 + 1) == "HTTP/1.1";
+        size_t contentLength = 0;
+        bool haveLength = false;
+        string apiKey;
+        for (size_t pos = lineEnd == string_view::npos ? head.size() : lineEnd + 2; pos < head.size();) {
+            size_t end = head.find("\r\n", pos);
+            if (end == string_view::npos) end = head.size();
+            string_view line = head.substr(pos, end - pos);
+            pos = end + 2;
+            size_t colon = line.find(':');
+            if (colon == string_view::npos) continue;
+            string_view name = line.substr(0, colon), value = line.substr(colon + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+            if (headerIs(name, "content-length")) {
+                // A length we can't read, or two that disagree, leaves no safe place for the next request
+                size_t length = 0;
+                if (!parseCount(string(value), length) || (haveLength && length != contentLength)) {
+                    reply(c, 400, nullptr, "", false);
+                    return false;
+                }
+                contentLength = length;
+                haveLength = true;
+            } else if (headerIs(name, "x-api-key")) apiKey = string(value);
+            else if (headerIs(name, "transfer-encoding")) { reply(c, 501, nullptr, "", false); return false; }
+            else if (headerIs(name, "connection")) {
+                if (headerIs(value, "close")) keepAlive = false;
+                else if (headerIs(value, "keep-alive")) keepAlive = true;
+            }
+        }
+        if (contentLength > maxBody) { reply(c, 413, nullptr, "", false); return false; }
+        size_t total = headerEnd + 4 + contentLength;
+        if (c.in.size() < total) return false;
+        string body = c.in.substr(headerEnd + 4, contentLength);
+        c.in.erase(0, total);
+        if (++c.served >= config.keepAliveMax) keepAlive = false;
+
+        string path = target.substr(0, target.find('?'));
+        if (method == "OPTIONS") {
+            reply(c, 200, nullptr, "", keepAlive);
+            return true;
+        }
+        if (method == "GET" && path == "/metrics") {
+            reply(c, 200, "text/plain; version=0.0.4", renderMetrics(), keepAlive);
+            return true;
+        }
+        if (method != "POST" || (path != "/analyze" && path != "/analyze/batch" && path != "/analyze/binary")) {
+            reply(c, 404, "application/json", "{ \"error\": \"not served in reactor mode\" }", keepAlive);
+            return true;
+        }
+        Endpoint endpoint = path == "/analyze/binary" ? ENDPOINT_BINARY
+                          : path == "/analyze/batch"  ? ENDPOINT_BATCH : ENDPOINT_ANALYZE;
+        Admission admission = g_admission.admit(endpoint, c.peer, apiKey, body.size());
+        if (admission.status != 200) {
+            RequestMetrics metrics(endpoint, body.size());
+            metrics.limited = admission.status == 429;
+            metrics.shed = admission.status == 503;
+            string error;
+            appendJsonError(error, refusalMessage(admission.status));
+            reply(c, admission.status, "application/json", error, keepAlive, admission.retryAfter);
+            return true;
+        }
+        c.busy = true;
+        pool.enqueue([this, id, path, target, body = move(body), keepAlive, gone = c.gone] {
+            bool batch = path == "/analyze/batch", binary = path == "/analyze/binary";
+            RequestMetrics metrics(binary ? ENDPOINT_BINARY : batch ? ENDPOINT_BATCH : ENDPOINT_ANALYZE, body.size());
+            // The reactor saw the peer close while this waited in the queue
+            if (gone->load(memory_order_relaxed)) {
+                metrics.abandoned = true;
+                return;
+            }
+            thread_local string json;     // reused by this pool thread across requests
+            json.clear();
+            int status = 200;
+            if (binary) {
+                status = analyzeFrameBody(body, json);
+                metrics.rejected = status != 200;
+            } else if (batch) {
+                status = analyzeBatchJson(body, json);
+                metrics.rejected = status != 200;
+            } else {
+                httplib::Params params;
+                size_t q = target.find('?');
+                if (q != string::npos) httplib::detail::parse_query_text(target.substr(q + 1), params);
+                httplib::detail::parse_query_text(body, params);
+                auto it = params.find("password");
+                metrics.rejected = it == params.end();
+                if (metrics.rejected) json = PASSWORD_REQUIRED_JSON;
+                else analyzeOneJson(it->second, json);
+            }
+            metrics.bytesOut = json.size();
+            {
+                lock_guard<mutex> guard(doneLock);
+                const char* type = binary && status == 200 ? FRAME_CONTENT_TYPE : "application/json";
+                done.push_back({id, httpResponse(status, type, json, keepAlive), !keepAlive});
+            }
+            uint64_t one = 1;
+            ssize_t ignored = write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        });
+        return true;
+    }
+
+    void readAll(uint64_t id, Connection& c) {
+        char buf[REACTOR_READ_CHUNK];
+        for (;;) {
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                c.in.append(buf, (size_t)n);
+                if (c.in.size() > REACTOR_MAX_HEADER + maxBody) { closeConnection(id); return; }
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            closeConnection(id);    // peer closed or reset
+            return;
+        }
+        c.lastActive = chrono::steady_clock::now();
+        serve(id, c);
+    }
+
+    // Answers buffered requests until one goes to the pool or data runs out, then writes.
+    void serve(uint64_t id, Connection& c) {
+        while (dispatch(id, c) && !c.busy) {}
+        flush(id, c);
+    }
+
+    void drainCompletions() {
+        uint64_t count;
+        while (read(wakeFd, &count, sizeof(count)) > 0) {}
+        vector<Completion> ready;
+        {
+            lock_guard<mutex> guard(doneLock);
+            ready.swap(done);
+        }
+        for (Completion& r : ready) {
+            auto it = conns.find(r.id);
+            if (it == conns.end()) continue;    // client went away meanwhile
+            Connection& c = it->second;
+            c.busy = false;
+            c.closeAfterWrite = r.close;
+            c.out += r.response;
+            c.lastActive = chrono::steady_clock::now();
+            if (flush(r.id, c)) serve(r.id, c);
+        }
+    }
+
+    void closeIdle() {
+        auto now = chrono::steady_clock::now();
+        vector<uint64_t> idle;
+        for (auto& entry : conns) {
+            const Connection& c = entry.second;
+            if (c.busy || !c.out.empty()) continue;
+            auto limit = chrono::seconds(c.in.empty() ? config.keepAliveTimeout : config.readTimeout);
+            if (now - c.lastActive > limit) idle.push_back(entry.first);
+        }
+        for (uint64_t id : idle) closeConnection(id);
+    }
+
+    bool listenOn(string& error) {
+        addrinfo hints = {}, *res = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (getaddrinfo(config.host.c_str(), to_string(config.port).c_str(), &hints, &res) != 0 || !res) {
+            error = "cannot resolve " + config.host;
+            return false;
+        }
+        listenFd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (listenFd >= 0) setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        bool ok = listenFd >= 0 && bind(listenFd, res->ai_addr, res->ai_addrlen) == 0 &&
+                  ::listen(listenFd, g_listenBacklog) == 0;
+        freeaddrinfo(res);
+        if (!ok) error = "cannot listen on " + config.host + ":" + to_string(config.port);
+        return ok;
+    }
+
+public:
+    explicit Reactor(const ServerConfig& cfg)
+        : config(cfg), maxBody(cfg.maxPayload ? cfg.maxPayload : REACTOR_DEFAULT_MAX_BODY),
+          pool(cfg.workers, cfg.pinThreads) {
+        g_admission.pool = &pool;   // the reactor checks the queue bound itself, before enqueueing
+    }
+
+    ~Reactor() {
+        pool.shutdown();
+        for (auto& entry : conns) ::close(entry.second.fd);
+        if (listenFd >= 0) ::close(listenFd);
+        if (wakeFd >= 0) ::close(wakeFd);
+        if (epfd >= 0) ::close(epfd);
+    }
+
+    bool run(string& error) {
+        if (!listenOn(error)) return false;
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epfd < 0 || wakeFd < 0) { error = "cannot create epoll set"; return false; }
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = REACTOR_LISTEN_ID;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.data.u64 = REACTOR_WAKE_ID;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+        epoll_event events[REACTOR_MAX_EVENTS];
+        auto lastSweep = chrono::steady_clock::now();
+        for (;;) {
+            int n = epoll_wait(epfd, events, REACTOR_MAX_EVENTS, 1000);
+            if (n < 0 && errno != EINTR) { error = "epoll_wait failed"; return false; }
+            for (int i = 0; i < n; i++) {
+                uint64_t id = events[i].data.u64;
+                if (id == REACTOR_LISTEN_ID) { acceptAll(); continue; }
+                if (id == REACTOR_WAKE_ID) { drainCompletions(); continue; }
+                auto it = conns.find(id);
+                if (it == conns.end()) continue;
+                Connection& c = it->second;
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) { closeConnection(id); continue; }
+                if (events[i].events & EPOLLOUT && !c.out.empty() && !flush(id, c)) continue;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP)) readAll(id, c);
+            }
+            auto now = chrono::steady_clock::now();
+            if (now - lastSweep >= chrono::seconds(1)) {
+                closeIdle();
+                lastSweep = now;
+            }
+        }
+    }
+};
+
+int runReactor(const ServerConfig& config) {
+    Reactor reactor(config);
+    cout << "Reactor running at http://" << config.host << ":" << config.port << " with "
+         << config.workers << (config.pinThreads ? " pinned" : "") << " workers\n";
+    string error;
+    reactor.run(error);
+    cerr << error << "\n";
+    return 1;
+}
+
+#else
+
+int runReactor(const ServerConfig&) {
+    cerr << "--reactor needs epoll and is only available on Linux\n";
+    return 1;
+}
+
+#endif
+
 /* =====================================================
    HTTP SERVER
    ===================================================== */
 
-int main() {
-    httplib::Server server;
+void printUsage() {
+    cerr << "Usage: backend [--index FILE] [--range FILE] [--cache-mb N] [--config FILE]\n"
+            "               [--host ADDR] [--port N] [--workers N] [--pin-threads] [--reactor]\n"
+            "               [--backlog N] [--keep-alive-max N] [--keep-alive-timeout SEC]\n"
+            "               [--read-timeout SEC] [--write-timeout SEC] [--max-payload BYTES]\n"
+            "               [--rate-limit N] [--key-rate-limit N] [--rate-burst N]\n"
+            "               [--max-queue N] [--shed-after-ms MS]\n"
+            "               [--shard NAME --ring NAME,...] [--shards [NAME=]HOST:PORT,...]\n"
+            "               [--admin-token TOKEN]\n"
+            "       backend [--index FILE] --file FILE|- [--threads N] [--stats]\n"
+            "               [--engine ac|per-pattern] [--cache-mb N]\n"
+            "       backend --build-index WORDLIST OUT [--min-length N]\n"
+            "       backend --build-range PASSWORDS|HASHES OUT [--shard NAME --ring NAME,...]\n";
+}
 
-    server.set_default_headers({
-        {"Access-Control-Allow-Origin", "*"},
-        {"Access-Control-Allow-Methods", "GET, POST, OPTIONS"},
-        {"Access-Control-Allow-Headers", "Content-Type"}
+// tests.cpp includes this file for its parsers and brings its own main.
+#ifndef PW_NO_SERVER_MAIN
+int main(int argc, char** argv) {
+    vector<string> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0] == "--build-index") {
+        size_t minLength = 4;
+        if (args.size() != 3 && !(args.size() == 5 && args[3] == "--min-length" && parseCount(args[4], minLength))) {
+            printUsage();
+            return 1;
+        }
+        return buildIndexCommand(args[1], args[2], minLength);
+    }
+    if (!args.empty() && args[0] == "--build-range") {
+        if (args.size() == 3) return buildRangeCommand(args[1], args[2]);
+        if (args.size() != 7 || args[3] != "--shard" || args[5] != "--ring") { printUsage(); return 1; }
+        HashRing ring;
+        string error;
+        if (!ring.parse(args[6], error)) { cerr << error << "\n"; return 1; }
+        int shard = ring.find(args[4]);
+        if (shard < 0) { cerr << "Shard " << args[4] << " is not in the ring\n"; return 1; }
+        return buildRangeCommand(args[1], args[2], &ring, shard);
+    }
+    string inputPath;
+    bool statsOnly = false;
+    size_t cacheMb = 0;
+    ServerConfig config;
+    string error;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--index" && i + 1 < args.size()) g_dictionaryPath = args[++i];
+        else if (args[i] == "--range" && i + 1 < args.size()) g_rangePath = args[++i];
+        else if (args[i] == "--file" && i + 1 < args.size()) inputPath = args[++i];
+        else if (args[i] == "--threads" && i + 1 < args.size() && parseCount(args[i + 1], g_workerThreads) &&
+                 g_workerThreads > 0)
+            i++;
+        else if (args[i] == "--stats") statsOnly = true;
+        else if (args[i] == "--cache-mb" && i + 1 < args.size() && parseCount(args[i + 1], cacheMb)) i++;
+        else if (args[i] == "--engine" && i + 1 < args.size() &&
+                 (args[i + 1] == "ac" || args[i + 1] == "per-pattern"))
+            g_matchEngine = args[++i] == "ac" ? MatchEngine::AhoCorasick : MatchEngine::PerPattern;
+        else if (args[i] == "--config" && i + 1 < args.size()) {
+            if (!loadServerConfig(config, args[++i], error)) { cerr << error << "\n"; return 1; }
+        }
+        else if (args[i] == "--pin-threads") config.pinThreads = true;
+        else if (args[i] == "--reactor") config.reactor = true;
+        else if (args[i].rfind("--", 0) == 0 && i + 1 < args.size() &&
+                 applyServerSetting(config, args[i].substr(2), args[i + 1]))
+            i++;
+        else { printUsage(); return 1; }
+    }
+
+    if (cacheMb) g_resultCache.reset(new ResultCache(cacheMb * 1024 * 1024));
+    if (!configureCluster(config, error)) {
+        cerr << error << "\n";
+        return 1;
+    }
+
+    if (!reloadPatternIndex(error)) {
+        cerr << "Failed to load index: " << error << "\n";
+        return 1;
+    }
+    if (!inputPath.empty()) return cliCommand(inputPath, statsOnly);
+
+    {
+        auto index = currentPatternIndex();     // scoped, so it doesn't pin the snapshot for the server's life
+        cout << "Loaded " << index->patterns.size() << " weak patterns";
+        if (index->skippedPatterns) cout << " (" << index->skippedPatterns << " over 255 bytes never match)";
+        if (index->dictionary) cout << " and " << index->dictionary->wordCount() << " dictionary words";
+        if (index->ranges) cout << ", serving " << index->ranges->hashCount() << " breached hashes";
+        if (g_shardIndex >= 0) cout << " as shard " << config.shard << " of " << g_shardRing.size();
+        if (g_router) cout << ", routing breach lookups to " << g_router->size() << " shards";
+        cout << "\n";
+    }
+#ifndef _WIN32
+    reloadOnSighup();
+#endif
+
+    g_admission.configure(config);
+    if (config.reactor) return runReactor(config);
+
+    ClientAwareServer server;
+    server.new_task_queue = [&config] {
+        auto pool = new WorkerPool(config.workers, config.pinThreads, config.maxQueue);
+        g_admission.pool = pool;
+        return pool;
+    };
+    server.set_keep_alive_max_count(config.keepAliveMax);
+    server.set_keep_alive_timeout(config.keepAliveTimeout);
+    server.set_read_timeout(config.readTimeout, 0);
+    server.set_write_timeout(config.writeTimeout, 0);
+    if (config.maxPayload) server.set_payload_max_length(config.maxPayload);
+
+    // CORS on every response but the admin ones, so pages elsewhere can't drive /admin/*
+    server.set_post_routing_handler([](const httplib::Request& req, httplib::Response& res) {
+        if (req.path.rfind("/admin/", 0) == 0) return;
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.set_header("Access-Control-Allow-Methods", "GET, POST, OPTIONS");
+        res.set_header("Access-Control-Allow-Headers", "Content-Type, X-API-Key");
     });
 
-    server.Options("/analyze", [](const httplib::Request&, httplib::Response& res) {
+    // CORS preflight for every POST route outside /admin/
+    server.Options(R"(/analyze(/batch|/stream|/binary)?|/breach/batch)", [](const httplib::Request&, httplib::Response& res) {
         res.status = 200;
     });
 
     server.Post("/analyze", [](const httplib::Request& req, httplib::Response& res) {
+        RequestMetrics metrics(ENDPOINT_ANALYZE, req.body.size());
+        if (refused(req, res, metrics)) return;
+        if (clientGone()) {
+            metrics.abandoned = true;
+            return;
+        }
         if (!req.has_param("password")) {
-            res.set_content("{ \"strength\": \"N/A\", \"suggestion\": \"Password required.\" }", "application/json");
+            metrics.rejected = 1;
+            res.set_content(PASSWORD_REQUIRED_JSON, JSON_TYPE);
+            return;
+        }
+        // Serialized straight into the response body; set_content would copy it
+        analyzeOneJson(req.get_param_value("password"), res.body);
+        res.set_header("Content-Type", JSON_TYPE);
+        metrics.bytesOut = res.body.size();
+    });
+
+    server.Post("/analyze/batch", [](const httplib::Request& req, httplib::Response& res) {
+        RequestMetrics metrics(ENDPOINT_BATCH, req.body.size());
+        if (refused(req, res, metrics)) return;
+        if (clientGone()) {
+            metrics.abandoned = true;
+            return;
+        }
+        res.status = analyzeBatchJson(req.body, res.body);
+        res.set_header("Content-Type", JSON_TYPE);
+        metrics.rejected = res.status != 200;
+        compressBody(req, res);
+        metrics.bytesOut = res.body.size();
+    });
+
+    server.Post("/analyze/binary", [](const httplib::Request& req, httplib::Response& res) {
+        RequestMetrics metrics(ENDPOINT_BINARY, req.body.size());
+        if (refused(req, res, metrics)) return;
+        if (clientGone()) {
+            metrics.abandoned = true;
+            return;
+        }
+        res.status = analyzeFrameBody(req.body, res.body);
+        res.set_header("Content-Type", res.status == 200 ? FRAME_CONTENT_TYPE : "application/json");
+        metrics.rejected = res.status != 200;
+        metrics.bytesOut = res.body.size();
+    });
+
+    // The provider pulls the request body itself, so results start flowing
+    // before the upload has finished.
+    server.Post("/analyze/stream", [](const httplib::Request& req, httplib::Response& res,
+                                      const httplib::ContentReader& reader) {
+        // Refused before the upload is read, so the connection can't be reused
+        Admission admission = admissionFor(req, ENDPOINT_STREAM);
+        if (admission.status != 200) {
+            RequestMetrics metrics(ENDPOINT_STREAM, 0);
+            refuseRequest(admission, res, metrics);
+            res.set_header("Connection", "close");
             return;
         }
-        string password = req.get_param_value("password");
-        auto result = analyzePassword(password);
+        const char* coding = nullptr;
+        shared_ptr<httplib::detail::compressor> compressor = compressorFor(req, coding);
+        if (coding) res.set_header("Content-Encoding", coding);
+        res.set_header("Vary", "Accept-Encoding");
+        res.set_chunked_content_provider("application/x-ndjson",
+            [reader, compressor](size_t, httplib::DataSink& sink) {
+                StreamAnalyzer stream(sink, compressor.get());
+                RequestMetrics metrics(ENDPOINT_STREAM, 0);
+                bool ok = reader([&](const char* data, size_t len) { return stream.feed(data, len); });
+                ok = ok && stream.finish();
+                metrics.bytesIn = stream.bytesIn;
+                metrics.bytesOut = stream.bytesOut;
+                metrics.rejected = stream.rejected;
+                if (!ok) return false;
+                sink.done();
+                return true;
+            });
+    });
 
-        string json = "{ \"strength\": \"" + result.first + "\", \"suggestion\": \"" + result.second + "\" }";
-        res.set_content(json, "application/json");
+    // k-anonymity breach check: clients send only the first five hex digits of SHA-1(password)
+    server.Get(R"(/range/([0-9A-Fa-f]{5}))", [](const httplib::Request& req, httplib::Response& res) {
+        RequestMetrics metrics(ENDPOINT_RANGE, 0);
+        if (refused(req, res, metrics)) return;
+        uint32_t prefix = (uint32_t)stoul(req.matches[1].str(), nullptr, 16);
+        if (g_router) {
+            g_router->forwardRange(prefix, req, res);
+            metrics.bytesOut = res.body.size();
+            return;
+        }
+        if (!ownsPrefix(prefix)) {
+            res.status = 421;
+            res.set_content("{ \"error\": \"prefix not held by this shard\" }", "application/json");
+            return;
+        }
+        auto index = currentPatternIndex();
+        if (!index->ranges) {
+            res.status = 404;
+            res.set_content("{ \"error\": \"no range table loaded\" }", "application/json");
+            return;
+        }
+        shared_ptr<const RangeTable> table = index->ranges;
+        char etag[40];
+        snprintf(etag, sizeof(etag), "\"%016llx-%05X\"", (unsigned long long)table->buildId(), prefix);
+        res.set_header("Cache-Control", RANGE_CACHE_CONTROL);
+        res.set_header("ETag", etag);
+        if (req.get_header_value("If-None-Match").find(etag) != string::npos) {
+            res.status = 304;
+            return;
+        }
+        string_view body = table->range(prefix);
+        metrics.bytesOut = body.size();
+        if (body.empty()) {
+            res.set_content("", "text/plain");
+            return;
+        }
+        // The provider holds the snapshot, so the mapping outlives a reload until the response is sent
+        res.set_content_provider(body.size(), "text/plain",
+                                 [table, body](size_t offset, size_t length, httplib::DataSink& sink) {
+                                     return sink.write(body.data() + offset, length);
+                                 });
     });
 
-    cout << "Server running at http://localhost:5000\n";
-    server.listen("0.0.0.0", 5000);
+    // Batch breach check over full hashes, answered locally or fanned out to the shards
+    server.Post("/breach/batch", [](const httplib::Request& req, httplib::Response& res) {
+        RequestMetrics metrics(ENDPOINT_BREACH, req.body.size());
+        if (refused(req, res, metrics)) return;
+        if (clientGone()) {
+            metrics.abandoned = true;
+            return;
+        }
+        res.status = breachBatchBody(req.body, res.body);
+        res.set_header("Content-Type", res.status == 200 ? JSON_TYPE : "application/json");
+        metrics.rejected = res.status != 200;
+        compressBody(req, res);
+        metrics.bytesOut = res.body.size();
+    });
+
+    server.Get("/metrics", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(renderMetrics(), "text/plain; version=0.0.4");
+    });
+
+    // Queues a background rebuild; GET reports its progress and the live snapshot
+    server.Post("/admin/reload", [](const httplib::Request& req, httplib::Response& res) {
+        RequestMetrics metrics(ENDPOINT_ADMIN, req.body.size());
+        if (adminRefused(req, res, metrics)) return;
+        indexReloader().request();
+        res.status = 202;
+        res.set_content(reloadStatusJson(), "application/json");
+    });
+
+    server.Get("/admin/reload", [](const httplib::Request& req, httplib::Response& res) {
+        RequestMetrics metrics(ENDPOINT_ADMIN, 0);
+        if (adminRefused(req, res, metrics)) return;
+        res.set_content(reloadStatusJson(), "application/json");
+    });
+
+    server.Get("/admin/cache", [](const httplib::Request& req, httplib::Response& res) {
+        RequestMetrics metrics(ENDPOINT_ADMIN, 0);
+        if (adminRefused(req, res, metrics)) return;
+        if (!g_resultCache) {
+            res.set_content("{ \"enabled\": false }", "application/json");
+            return;
+        }
+        CacheStats cache = g_resultCache->stats();
+        JsonWriter(res.body).beginObject()
+            .field("enabled", true)
+            .field("capacity", cache.capacity)
+            .field("entries", cache.entries)
+            .field("hits", cache.hits)
+            .field("misses", cache.misses)
+            .endObject();
+        res.set_header("Content-Type", "application/json");
+    });
+
+    cout << "Server running at http://" << config.host << ":" << config.port << " with "
+         << config.workers << (config.pinThreads ? " pinned" : "") << " workers\n";
+    if (!server.listen(config.host.c_str(), config.port)) {
+        cerr << "Cannot listen on " << config.host << ":" << config.port << "\n";
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,262 @@
+/* =====================================================
+   MATCHER AND ANALYZER BENCHMARKS
+   Google Benchmark suite over the engine in analyzer.h.
+   Build and run, keeping JSON results for comparison:
+
+     g++ -O2 -std=c++17 bench.cpp -o bench -lbenchmark -lpthread
+     ./bench --benchmark_out=bench_output.json --benchmark_out_format=json
+
+   Arguments are {password length, ...} plus, where it
+   applies, the dictionary size and whether the input
+   contains a match (1) or not (0).
+   ===================================================== */
+#include <benchmark/benchmark.h>
+#include <map>
+#include <sstream>
+
+#include "analyzer.h"
+
+/* =====================================================
+   INPUT GENERATION
+   Fixed seeds, so every run measures the same inputs.
+   ===================================================== */
+
+const size_t INPUT_POOL = 256;      // distinct inputs cycled per benchmark
+const char* const BENCH_PATTERN = "sunshine";
+
+string randomString(mt19937& rng, size_t length, const char* alphabet) {
+    size_t n = strlen(alphabet);
+    string s(length, ' ');
+    for (char& c : s) c = alphabet[rng() % n];
+    return s;
+}
+
+// Random printable text, with pattern written over its end when match is set.
+vector<string> makeTexts(size_t length, bool match, const string& pattern) {
+    mt19937 rng(42);
+    vector<string> texts;
+    for (size_t i = 0; i < INPUT_POOL; i++) {
+        string s = randomString(rng, length, "bcdfghjkmnpqrtvwxz0123456789!@#$%^&*");
+        if (match && pattern.length() <= length) s.replace(length - pattern.length(), pattern.length(), pattern);
+        texts.push_back(move(s));
+    }
+    return texts;
+}
+
+vector<string> makeWords(size_t count) {
+    mt19937 rng(7);
+    vector<string> words;
+    for (size_t i = 0; i < count; i++)
+        words.push_back(randomString(rng, 5 + rng() % 6, "abcdefghijklmnopqrstuvwxyz"));
+    return words;
+}
+
+// A dictionary index of count random words, built once per size into the temp directory.
+shared_ptr<const DictionaryIndex> benchDictionary(size_t count) {
+    static map<size_t, shared_ptr<const DictionaryIndex>> built;
+    if (count == 0) return nullptr;
+    auto& slot = built[count];
+    if (slot) return slot;
+
+    string base = (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") + string("/pw_bench_") + to_string(count);
+    {
+        ofstream list(base + ".txt", ios::trunc);
+        for (const string& w : makeWords(count)) list << w << "\n";
+        list << BENCH_PATTERN << "\n";
+    }
+    // Keep the builder's summary line out of the benchmark report
+    ostringstream quiet;
+    streambuf* saved = cout.rdbuf(quiet.rdbuf());
+    int status = buildIndexCommand(base + ".txt", base + ".idx", 1);
+    cout.rdbuf(saved);
+
+    auto dictionary = make_shared<DictionaryIndex>();
+    string error;
+    if (status != 0 || !dictionary->open(base + ".idx", error)) {
+        cerr << "Cannot build benchmark dictionary: " << error << "\n";
+        exit(1);
+    }
+    return slot = dictionary;
+}
+
+const PatternIndex& benchIndex(size_t dictionarySize) {
+    static map<size_t, shared_ptr<const PatternIndex>> built;
+    auto& slot = built[dictionarySize];
+    if (!slot) slot = buildPatternIndex(WEAK_PATTERN_FILE, benchDictionary(dictionarySize), nullptr);
+    return *slot;
+}
+
+void reportInputs(benchmark::State& state, size_t length) {
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * (int64_t)length);
+}
+
+/* =====================================================
+   SINGLE-PATTERN MATCHERS
+   ===================================================== */
+
+void lengthAndMatchArgs(benchmark::internal::Benchmark* b) {
+    for (int length : {8, 16, 64, 256, 1024})
+        for (int match : {0, 1}) b->Args({length, match});
+}
+
+void BM_BruteForceMatch(benchmark::State& state) {
+    vector<string> texts = makeTexts(state.range(0), state.range(1), BENCH_PATTERN);
+    string pattern = BENCH_PATTERN;
+    size_t i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(bruteForceMatch(texts[i++ % INPUT_POOL], pattern));
+    reportInputs(state, state.range(0));
+}
+BENCHMARK(BM_BruteForceMatch)->Apply(lengthAndMatchArgs);
+
+void BM_KMPMatch(benchmark::State& state) {
+    vector<string> texts = makeTexts(state.range(0), state.range(1), BENCH_PATTERN);
+    string pattern = BENCH_PATTERN;
+    size_t i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(KMPMatch(texts[i++ % INPUT_POOL], pattern));
+    reportInputs(state, state.range(0));
+}
+BENCHMARK(BM_KMPMatch)->Apply(lengthAndMatchArgs);
+
+void BM_CompiledPatternFind(benchmark::State& state) {
+    vector<string> texts = makeTexts(state.range(0), state.range(1), BENCH_PATTERN);
+    CompiledPattern pattern(BENCH_PATTERN);
+    size_t i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(pattern.find(texts[i++ % INPUT_POOL]));
+    reportInputs(state, state.range(0));
+}
+BENCHMARK(BM_CompiledPatternFind)->Apply(lengthAndMatchArgs);
+
+/* =====================================================
+   TRIE LOOKUP AND SCAN
+   ===================================================== */
+
+void dictionaryAndMatchArgs(benchmark::internal::Benchmark* b) {
+    for (int size : {1000, 10000, 100000})
+        for (int match : {0, 1}) b->Args({size, match});
+}
+
+void BM_TrieSearch(benchmark::State& state) {
+    vector<string> words = makeWords(state.range(0));
+    Trie trie;
+    for (const string& w : words) trie.insert(w);
+    trie.build();
+    // Misses bump the last letter of a stored word, so they share its whole prefix
+    vector<string> queries(words.begin(), words.begin() + min(words.size(), INPUT_POOL));
+    if (!state.range(1))
+        for (string& q : queries) q.back() = q.back() == 'z' ? '{' : (char)(q.back() + 1);
+    size_t i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(trie.search(queries[i++ % queries.size()]));
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TrieSearch)->Apply(dictionaryAndMatchArgs);
+
+void BM_TrieScan(benchmark::State& state) {
+    vector<string> words = makeWords(state.range(0));
+    Trie trie;
+    for (const string& w : words) trie.insert(w);
+    trie.insert(BENCH_PATTERN);
+    trie.build();
+    vector<string> texts = makeTexts(32, state.range(1), BENCH_PATTERN);
+    size_t i = 0;
+    for (auto _ : state) {
+        size_t found = 0;
+        trie.scan(texts[i++ % INPUT_POOL], [&](const PatternMatch&) { found++; });
+        benchmark::DoNotOptimize(found);
+    }
+    reportInputs(state, 32);
+}
+BENCHMARK(BM_TrieScan)->Apply(dictionaryAndMatchArgs);
+
+// The ranked-word list through the runtime trie and through its compile-time automaton.
+void BM_RankedWordsTrie(benchmark::State& state) {
+    Trie trie;
+    for (size_t i = 0; i < RANKED_WORD_COUNT; i++) trie.insert(RANKED_WORDS[i], (int)i);
+    trie.build();
+    vector<string> texts = makeTexts(state.range(0), state.range(1), BENCH_PATTERN);
+    size_t i = 0;
+    for (auto _ : state) {
+        size_t found = 0;
+        trie.scan(texts[i++ % INPUT_POOL], [&](const PatternMatch&) { found++; });
+        benchmark::DoNotOptimize(found);
+    }
+    reportInputs(state, state.range(0));
+}
+BENCHMARK(BM_RankedWordsTrie)->Apply(lengthAndMatchArgs);
+
+void BM_RankedWordsStatic(benchmark::State& state) {
+    vector<string> texts = makeTexts(state.range(0), state.range(1), BENCH_PATTERN);
+    size_t i = 0;
+    for (auto _ : state) {
+        size_t found = 0;
+        RANKED_WORD_AUTOMATON.scan(texts[i++ % INPUT_POOL], [&](const PatternMatch&) { found++; });
+        benchmark::DoNotOptimize(found);
+    }
+    reportInputs(state, state.range(0));
+}
+BENCHMARK(BM_RankedWordsStatic)->Apply(lengthAndMatchArgs);
+
+/* =====================================================
+   REPEAT CHECKS
+   The triple-repeat check that used to be a regex now
+   runs inside the character profile; scanRuns finds the
+   longest repeat, sequence and keyboard runs.
+   ===================================================== */
+
+void BM_CharProfile(benchmark::State& state) {
+    vector<string> texts = makeTexts(state.range(0), state.range(1), "aaa");
+    size_t i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(profileChars(texts[i++ % INPUT_POOL]));
+    reportInputs(state, state.range(0));
+}
+BENCHMARK(BM_CharProfile)->Apply(lengthAndMatchArgs);
+
+void BM_ScanRuns(benchmark::State& state) {
+    vector<string> texts = makeTexts(state.range(0), state.range(1), "qwerty");
+    size_t i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(scanRuns(texts[i++ % INPUT_POOL]));
+    reportInputs(state, state.range(0));
+}
+BENCHMARK(BM_ScanRuns)->Apply(lengthAndMatchArgs);
+
+/* =====================================================
+   END-TO-END ANALYSIS
+   ===================================================== */
+
+void analyzerArgs(benchmark::internal::Benchmark* b) {
+    for (int length : {8, 16, 64})
+        for (int size : {0, 10000, 100000})
+            for (int match : {0, 1}) b->Args({length, size, match});
+}
+
+void BM_AnalyzePassword(benchmark::State& state) {
+    const PatternIndex& index = benchIndex(state.range(1));
+    vector<string> passwords = makeTexts(state.range(0), state.range(2), BENCH_PATTERN);
+    AnalysisResult result;
+    size_t i = 0;
+    for (auto _ : state) {
+        analyzePassword(passwords[i++ % INPUT_POOL], index, result);
+        benchmark::DoNotOptimize(result);
+    }
+    reportInputs(state, state.range(0));
+}
+BENCHMARK(BM_AnalyzePassword)->Apply(analyzerArgs);
+
+// Serializing a finished result into a reused buffer, as the server handlers do.
+void BM_ResultJson(benchmark::State& state) {
+    const PatternIndex& index = benchIndex(0);
+    vector<AnalysisResult> results(INPUT_POOL);
+    vector<string> passwords = makeTexts(state.range(0), state.range(1), BENCH_PATTERN);
+    for (size_t i = 0; i < INPUT_POOL; i++) analyzePassword(passwords[i], index, results[i]);
+    string out;
+    size_t i = 0;
+    for (auto _ : state) {
+        out.clear();
+        appendResultJson(out, results[i++ % INPUT_POOL]);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ResultJson)->Args({8, 0})->Args({16, 1})->Args({64, 1});
+
+BENCHMARK_MAIN();
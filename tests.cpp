@@ -0,0 +1,916 @@
+/* =====================================================
+   ENGINE AND PARSER TESTS
+   Plain checks over the engine in analyzer.h and the
+   server's frame and setting parsers, built the same way
+   as bench.cpp; it prints every failed check and exits
+   nonzero if there was one:
+
+     g++ -O2 -std=c++17 tests.cpp -o tests -lpthread && ./tests
+
+   backend.cpp is included whole, without its main.
+   ===================================================== */
+#define PW_NO_SERVER_MAIN
+#include "backend.cpp"
+
+int g_failures = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed\n"; \
+            g_failures++;                                                        \
+        }                                                                        \
+    } while (0)
+
+string repeated(const string& block, size_t times) {
+    string s;
+    for (size_t i = 0; i < times; i++) s += block;
+    return s;
+}
+
+const PatternIndex& testIndex() {
+    static shared_ptr<const PatternIndex> index = buildPatternIndex(WEAK_PATTERN_FILE, nullptr, nullptr);
+    return *index;
+}
+
+AnalysisResult analyzed(const string& password) {
+    AnalysisResult result;
+    analyzePassword(password, testIndex(), result);
+    return result;
+}
+
+/* =====================================================
+   GUESS ESTIMATOR
+   ===================================================== */
+
+// Long passwords made of one weak block must not gain strength from their length.
+void testLongRepeatsStayWeak() {
+    for (const string& s : {repeated("password", 8), repeated("password", 9), string(300, 'a'),
+                            repeated("1234567890", 7), string(70, 'a'), string(10, 'a')})
+        CHECK(analyzed(s).strength == Strength::Weak);
+    // Runs past the matched head are priced as runs, not one brute-force digit per character
+    CHECK(analyzed(string(64, 'k') + "zxcvbnm" + "abcdefgh" + string(40, 'k')).log10Guesses < 15);
+    CHECK(analyzed(string(70, 'a')).log10Guesses < analyzed("aB3$xQ9!mZ").log10Guesses);
+}
+
+// A repeated strong block is still strong, and a tail of new text still counts.
+void testLongPasswordsKeepTheirStrength() {
+    CHECK(analyzed(repeated("xK9#mQ2$vL7!", 6)).strength == Strength::Strong);
+    string random = "Vq8#Lm2!Rz7@Kp4$Wt9%Hx3^Bn6&Jd1*";
+    CHECK(analyzed(random + random + "Zf5(Gy0)Cs8_Qe2+").log10Guesses > analyzed(random + random).log10Guesses);
+}
+
+/* =====================================================
+   CHARACTER PROFILE KERNELS
+   Every vector kernel the CPU can run must agree with
+   the scalar one, including around each class boundary,
+   on non-ASCII bytes and in the tails past a full block.
+   ===================================================== */
+
+vector<pair<string, ProfileKernel>> profileKernels() {
+    vector<pair<string, ProfileKernel>> kernels = {{"selected", profileChars}};
+#if PW_SIMD_X86
+    kernels.push_back({"sse2", profileSse2});
+#if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) kernels.push_back({"avx2", profileAvx2});
+#endif
+#endif
+#if PW_SIMD_NEON
+    kernels.push_back({"neon", profileNeon});
+#endif
+    return kernels;
+}
+
+void testProfileKernelsMatchScalar() {
+    const string edges = "@AZ[`az{/09: ~\x7f\x80\xff";
+    mt19937 rng(11);
+    for (const auto& kernel : profileKernels()) {
+        for (size_t length = 0; length <= 100; length++)
+            for (int trial = 0; trial < 20; trial++) {
+                string s(length, ' ');
+                for (char& c : s) c = rng() % 2 ? edges[rng() % edges.size()] : (char)rng();
+                CHECK(kernel.second(s).classes == profileScalar(s).classes);
+            }
+        // One byte of another class at every position of a lowercase string
+        for (char odd : {'A', 'Z', '0', '9', '@', '[', '`', '{', (char)0x80})
+            for (size_t at = 0; at < 70; at++) {
+                string s(70, 'm');
+                s[at] = odd;
+                CHECK(kernel.second(s).classes == (CLASS_LOWER | classifyByte((uint8_t)odd)));
+            }
+    }
+}
+
+bool hasRepeatRun(string_view s) {
+    return scanRuns(s).repeat.length >= MIN_REPEAT_RUN;
+}
+
+// The in-kernel triple check must agree with scanRuns' repeat run.
+void testProfileTriplesMatchScanRuns() {
+    mt19937 rng(13);
+    for (const auto& kernel : profileKernels()) {
+        // A three-letter alphabet makes triples common but not certain
+        for (size_t length = 0; length <= 100; length++)
+            for (int trial = 0; trial < 20; trial++) {
+                string s(length, ' ');
+                for (char& c : s) c = "abc"[rng() % 3];
+                CHECK(kernel.second(s).hasTriple == hasRepeatRun(s));
+            }
+        // One triple at every offset, so some straddle each block boundary
+        for (size_t length : {16, 17, 18, 31, 32, 33, 34, 70})
+            for (size_t at = 0; at + 3 <= length; at++) {
+                string s(length, ' ');
+                for (size_t i = 0; i < length; i++) s[i] = "xy"[i % 2];
+                s[at] = s[at + 1] = s[at + 2] = '7';
+                CHECK(kernel.second(s).hasTriple);
+                CHECK(hasRepeatRun(s));
+            }
+        // Pairs alone are not a repeat, wherever they fall
+        string pairs;
+        for (int i = 0; i < 40; i++) pairs += string(2, (char)('a' + i % 26));
+        CHECK(!kernel.second(pairs).hasTriple);
+        CHECK(!hasRepeatRun(pairs));
+    }
+}
+
+/* =====================================================
+   RUN DETECTION
+   ===================================================== */
+
+bool sameRun(const Run& run, size_t start, size_t length) {
+    return run.start == start && run.length == length;
+}
+
+void testScanRunsFindsEachKind() {
+    RunReport r = scanRuns("aaab");
+    CHECK(sameRun(r.repeat, 0, 3));
+    CHECK(sameRun(r.sequence, 2, 2));
+    CHECK(sameRun(r.keyboard, 0, 1));
+
+    r = scanRuns("9876");
+    CHECK(sameRun(r.sequence, 0, 4));
+    CHECK(sameRun(r.repeat, 0, 1));
+
+    r = scanRuns("qwerty");
+    CHECK(sameRun(r.keyboard, 0, 6));
+    CHECK(sameRun(r.sequence, 0, 1));
+
+    r = scanRuns("xxasdf");
+    CHECK(sameRun(r.keyboard, 2, 4));
+    CHECK(sameRun(r.repeat, 0, 2));
+
+    r = scanRuns("x1234567y");
+    CHECK(sameRun(r.sequence, 1, 7));
+}
+
+void testScanRunsEdges() {
+    RunReport r = scanRuns("");
+    CHECK(r.repeat.length == 0 && r.sequence.length == 0 && r.keyboard.length == 0);
+    r = scanRuns("a");
+    CHECK(sameRun(r.repeat, 0, 1) && sameRun(r.sequence, 0, 1) && sameRun(r.keyboard, 0, 1));
+
+    // Sequences and walks ignore case; repeats compare the bytes themselves
+    CHECK(sameRun(scanRuns("ABCD").sequence, 0, 4));
+    CHECK(sameRun(scanRuns("QwEr").keyboard, 0, 4));
+    CHECK(sameRun(scanRuns("aAaA").repeat, 0, 1));
+
+    // A turn starts a new run that keeps the turning character; the first longest run wins
+    CHECK(sameRun(scanRuns("abcba").sequence, 0, 3));
+    CHECK(sameRun(scanRuns("qwewq").keyboard, 0, 3));
+    CHECK(sameRun(scanRuns("abzcde").sequence, 3, 3));
+
+    // Steps don't cross from digits to letters, wrap around, or leave a keyboard row
+    CHECK(sameRun(scanRuns("89ab").sequence, 0, 2));
+    CHECK(sameRun(scanRuns("zab").sequence, 1, 2));
+    CHECK(sameRun(scanRuns("poa").keyboard, 0, 2));
+    CHECK(sameRun(scanRuns("jkl;").keyboard, 0, 3));
+}
+
+// The longest repeat agrees with a plain search on random text.
+void testScanRunsLongestRepeat() {
+    mt19937 rng(17);
+    for (int trial = 0; trial < 2000; trial++) {
+        string s(rng() % 40, ' ');
+        for (char& c : s) c = "aab"[rng() % 3];
+        Run expected{0, s.empty() ? 0u : 1u};
+        for (size_t i = 0; i < s.size();) {
+            size_t j = i;
+            while (j < s.size() && s[j] == s[i]) j++;
+            if (j - i > expected.length) expected = {i, j - i};
+            i = j;
+        }
+        CHECK(sameRun(scanRuns(s).repeat, expected.start, expected.length));
+    }
+}
+
+/* =====================================================
+   PATTERN AUTOMATA
+   The automata report every occurrence of every word,
+   in order of end position and, at one end, longest
+   first. A word listed twice reports its first id.
+   ===================================================== */
+
+vector<tuple<size_t, size_t, int>> bruteForceMatches(string_view text, const vector<string>& words) {
+    vector<tuple<size_t, size_t, int>> matches;
+    size_t longest = 0;
+    for (const string& w : words) longest = max(longest, w.size());
+    for (size_t end = 1; end <= text.size(); end++)
+        for (size_t length = min(longest, end); length > 0; length--)
+            for (size_t w = 0; w < words.size(); w++)
+                if (words[w].size() == length && text.compare(end - length, length, words[w]) == 0) {
+                    matches.emplace_back(end - length, length, (int)w);
+                    break;
+                }
+    return matches;
+}
+
+template <typename Matcher>
+vector<tuple<size_t, size_t, int>> scannedMatches(const Matcher& matcher, string_view text) {
+    vector<tuple<size_t, size_t, int>> matches;
+    matcher.scan(text, [&](const PatternMatch& m) { matches.emplace_back(m.start, m.length, m.patternId); });
+    return matches;
+}
+
+string randomText(mt19937& rng, size_t length, const char* alphabet) {
+    string s(length, ' ');
+    for (char& c : s) c = alphabet[rng() % strlen(alphabet)];
+    return s;
+}
+
+// Small alphabets, so words overlap, nest and repeat.
+void testTrieScanMatchesBruteForce() {
+    mt19937 rng(23);
+    for (int list = 0; list < 200; list++) {
+        vector<string> words;
+        for (size_t n = 1 + rng() % 12; words.size() < n;) words.push_back(randomText(rng, 1 + rng() % 5, "abc"));
+        Trie trie;
+        for (size_t w = 0; w < words.size(); w++) trie.insert(words[w], (int)w);
+        CHECK(trie.build());
+        for (int t = 0; t < 20; t++) {
+            string text = randomText(rng, rng() % 30, "abcd");
+            CHECK(scannedMatches(trie, text) == bruteForceMatches(text, words));
+        }
+    }
+}
+
+void testTrieLimits() {
+    Trie trie;
+    CHECK(trie.insert(string(255, 'x'), 0));
+    CHECK(!trie.insert(string(256, 'y'), 1));
+    CHECK(trie.insert("", 2));         // ignored, as an empty pattern matches nowhere
+    CHECK(trie.skippedWords() == 1);
+    CHECK(trie.build());
+    CHECK(trie.search(string(255, 'x')));
+    CHECK(!trie.search(string(256, 'y')));
+    CHECK(trie.findAll("y" + string(300, 'x')).size() == 46);
+}
+
+// Nested, overlapping and repeated words for the compile-time automaton.
+constexpr const char* OVERLAPPING_WORDS[] = {"he", "she", "his", "hers", "a", "aa", "aaa", "abab", "bab", "aa", "s"};
+constexpr StaticAutomaton<OVERLAPPING_WORDS> OVERLAPPING_AUTOMATON;
+
+// Random text stitched from pieces of the words and stray letters, so matches are common.
+template <size_t N>
+string textFromWords(mt19937& rng, const char* const (&words)[N]) {
+    string text;
+    while (text.size() < 40) {
+        string piece = rng() % 3 ? words[rng() % N] : string(1, "abehirs1!"[rng() % 9]);
+        text += piece.substr(rng() % 2 ? 0 : rng() % piece.size());
+    }
+    return text;
+}
+
+template <size_t N, typename Automaton>
+void checkStaticAutomaton(const char* const (&list)[N], const Automaton& automaton) {
+    vector<string> words(list, list + N);
+    Trie trie;
+    for (size_t w = 0; w < N; w++) trie.insert(words[w], (int)w);
+    CHECK(trie.build());
+    mt19937 rng(29);
+    for (int t = 0; t < 2000; t++) {
+        string text = textFromWords(rng, list);
+        auto matches = scannedMatches(automaton, text);
+        CHECK(matches == bruteForceMatches(text, words));
+        CHECK(matches == scannedMatches(trie, text));
+    }
+}
+
+void testStaticAutomataMatchBruteForce() {
+    checkStaticAutomaton(OVERLAPPING_WORDS, OVERLAPPING_AUTOMATON);
+    checkStaticAutomaton(DEFAULT_WEAK_PATTERNS, DEFAULT_WEAK_PATTERN_AUTOMATON);
+    checkStaticAutomaton(RANKED_WORDS, RANKED_WORD_AUTOMATON);
+    // Bytes outside every word all fall into one class and reset the scan
+    string stray = "sh\xff" "e h\x80" "ers";
+    CHECK(scannedMatches(OVERLAPPING_AUTOMATON, stray) ==
+          bruteForceMatches(stray, vector<string>(begin(OVERLAPPING_WORDS), end(OVERLAPPING_WORDS))));
+}
+
+/* =====================================================
+   JSON WRITER
+   ===================================================== */
+
+string jsonString(string_view s) {
+    string out;
+    JsonWriter(out).value(s);
+    return out;
+}
+
+// Reverses the writer's escapes; "" with ok cleared if text isn't one well-formed string.
+string unescapeJson(string_view text, bool& ok) {
+    ok = text.size() >= 2 && text.front() == '"' && text.back() == '"';
+    string out;
+    for (size_t i = 1; ok && i + 1 < text.size(); i++) {
+        uint8_t c = (uint8_t)text[i];
+        if (c < 0x20 || c == '"') { ok = false; break; }
+        if (c != '\\') { out += (char)c; continue; }
+        if (++i + 1 >= text.size()) { ok = false; break; }
+        switch (text[i]) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u':
+            if (i + 5 >= text.size() || text.substr(i + 1, 2) != "00") { ok = false; break; }
+            out += (char)stoi(string(text.substr(i + 3, 2)), nullptr, 16);
+            i += 4;
+            break;
+        default: ok = false;
+        }
+    }
+    return ok ? out : "";
+}
+
+void testJsonEscaping() {
+    CHECK(jsonString("plain") == "\"plain\"");
+    CHECK(jsonString("say \"hi\"") == "\"say \\\"hi\\\"\"");
+    CHECK(jsonString("C:\\dir\\") == "\"C:\\\\dir\\\\\"");
+    CHECK(jsonString("a\nb\rc\td\be\ff") == "\"a\\nb\\rc\\td\\be\\ff\"");
+    CHECK(jsonString(string("\0\x01\x1f", 3)) == "\"\\u0000\\u0001\\u001f\"");
+    CHECK(jsonString("\x7f h\xc3\xa9llo \xe2\x9c\x93") == "\"\x7f h\xc3\xa9llo \xe2\x9c\x93\"");    // UTF-8 as is
+
+    // Every byte value survives a round trip, and no raw control byte is written
+    mt19937 rng(31);
+    for (int trial = 0; trial < 2000; trial++) {
+        string s(rng() % 20, ' ');
+        for (char& c : s) c = (char)(rng() % 2 ? rng() % 0x24 : rng());    // half control bytes and quotes
+        bool ok;
+        CHECK(unescapeJson(jsonString(s), ok) == s);
+        CHECK(ok);
+    }
+}
+
+void testJsonLayout() {
+    string out = "prefix:";
+    JsonWriter json(out);
+    json.beginObject()
+        .field("n", -42)
+        .field("big", UINT64_MAX)
+        .field("pi", 3.14159, 2)
+        .field("nan", nan(""), 2)
+        .field("ok", true)
+        .field("key \"q\"", "v");
+    json.key("list").beginArray().value("x").value(1).endArray();
+    json.key("empty").beginObject().endObject();
+    json.endObject();
+    CHECK(out == "prefix:{ \"n\": -42, \"big\": 18446744073709551615, \"pi\": 3.14, \"nan\": null, \"ok\": true, "
+                 "\"key \\\"q\\\"\": \"v\", \"list\": [\"x\", 1], \"empty\": {} }");
+}
+
+/* =====================================================
+   RANGE TABLE
+   ===================================================== */
+
+string sha1Hex(string_view data) {
+    Sha1Digest digest = sha1(data);
+    string hex;
+    for (uint8_t b : digest.bytes) hex += {RANGE_HEX[b >> 4], RANGE_HEX[b & 15]};
+    return hex;
+}
+
+string testFilePath(const string& name) {
+    return (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") + string("/pw_tests_") + name;
+}
+
+// Builds a range table from lines, keeping the builder's summary out of the test output.
+bool builtRangeTable(const vector<string>& lines, RangeTable& table, const HashRing* ring = nullptr, size_t shard = 0) {
+    string list = testFilePath("range.txt"), path = testFilePath("range.rng");
+    {
+        ofstream out(list, ios::trunc);
+        for (const string& line : lines) out << line << "\n";
+    }
+    ostringstream quiet;
+    streambuf* saved = cout.rdbuf(quiet.rdbuf());
+    int status = buildRangeCommand(list, path, ring, shard);
+    cout.rdbuf(saved);
+    string error;
+    bool opened = status == 0 && table.open(path, error);
+    remove(list.c_str());
+    remove(path.c_str());       // the mapping stays valid after the name is gone
+    return opened;
+}
+
+void testSha1() {
+    CHECK(sha1Hex("") == "DA39A3EE5E6B4B0D3255BFEF95601890AFD80709");
+    CHECK(sha1Hex("abc") == "A9993E364706816ABA3E25717850C26C9CD0D89D");
+    CHECK(sha1Hex(string(1000000, 'a')) == "34AA973CD4C4DAA4F61EEB2BDBAD27316534016F");
+}
+
+void testRangeTableCounts() {
+    // Plain passwords and hashed lines in either case; duplicates add up
+    string lowerHex = sha1Hex("hunter2");
+    for (char& c : lowerHex) c = (char)tolower((uint8_t)c);
+    vector<string> lines = {"password1", "password1", "hunter2", sha1Hex("letmein") + ":7", "", "Hunter2", lowerHex + ":3"};
+    map<string, uint32_t> expected = {{"password1", 2}, {"hunter2", 4}, {"letmein", 7}, {"Hunter2", 1}};
+    // Enough random passwords that many prefixes hold several lines
+    mt19937 rng(37);
+    for (int i = 0; i < 20000; i++) {
+        string password = randomText(rng, 6 + rng() % 6, "abcdefghijklmnopqrstuvwxyz0123456789");
+        lines.push_back(password);
+        expected[password]++;
+    }
+    RangeTable table;
+    CHECK(builtRangeTable(lines, table));
+    CHECK(table.hashCount() == expected.size());
+    CHECK(table.shardId() == 0);
+    for (const auto& [password, count] : expected) CHECK(table.count(sha1(password)) == count);
+    for (int i = 0; i < 2000; i++) CHECK(table.count(sha1("absent-" + to_string(i))) == 0);
+
+    // A prefix's body is its sorted "SUFFIX:COUNT" lines
+    string hash = sha1Hex("password1");
+    string_view body = table.range(rangePrefix(sha1("password1").bytes));
+    CHECK(body.find(hash.substr(RANGE_PREFIX_DIGITS) + ":2\r\n") != string::npos);
+    vector<string_view> suffixes;
+    for (size_t pos = 0; pos < body.size(); pos = body.find('\n', pos) + 1) suffixes.push_back(body.substr(pos, RANGE_SUFFIX_DIGITS));
+    CHECK(is_sorted(suffixes.begin(), suffixes.end()));
+}
+
+/* =====================================================
+   HASH RING
+   ===================================================== */
+
+HashRing parsedRing(const string& spec) {
+    HashRing ring;
+    string error;
+    CHECK(ring.parse(spec, error));
+    return ring;
+}
+
+void testHashRingParse() {
+    HashRing ring;
+    string error;
+    CHECK(!ring.parse("", error) && error == "no shards in ring");
+    CHECK(!ring.parse(" , ,", error) && error == "no shards in ring");
+    CHECK(!ring.parse("a,b,a", error) && error == "shard names repeat in ring");
+    CHECK(ring.parse(" b , a,,c ", error) && ring.size() == 3);
+    CHECK(ring.find("a") == 0 && ring.find("c") == 2 && ring.find("d") == -1);
+}
+
+// Owners only depend on the set of names, and are pinned: range tables built for a shard rely on them.
+void testHashRingOwnersAreStable() {
+    HashRing ring = parsedRing("alpha,beta,gamma"), shuffled = parsedRing(" gamma ,alpha,beta");
+    for (uint32_t prefix = 0; prefix < RANGE_PREFIXES; prefix += 7)
+        CHECK(ring.name(ring.ownerOf(prefix)) == shuffled.name(shuffled.ownerOf(prefix)));
+    CHECK(ring.name(ring.ownerOf(0x00000)) == "alpha");
+    CHECK(ring.name(ring.ownerOf(0x00001)) == "beta");
+    CHECK(ring.name(ring.ownerOf(0xABCDE)) == "beta");
+    CHECK(ring.name(ring.ownerOf(0x5F00D)) == "gamma");
+    CHECK(ring.name(ring.ownerOf(0xFFFFF)) == "beta");
+
+    // Each shard holds a fair share
+    vector<size_t> owned(ring.size());
+    for (uint32_t prefix = 0; prefix < RANGE_PREFIXES; prefix++) owned[ring.ownerOf(prefix)]++;
+    for (size_t n : owned) CHECK(n > RANGE_PREFIXES / 5 && n < RANGE_PREFIXES / 2);
+
+    // Shard ids are nonzero, differ between shards and change with the ring
+    CHECK(ring.shardId(0) != 0 && ring.shardId(0) != ring.shardId(1) && ring.shardId(1) != ring.shardId(2));
+    CHECK(ring.shardId(0) == shuffled.shardId(0));
+    CHECK(ring.shardId(0) != parsedRing("alpha,beta").shardId(0));
+}
+
+// Adding a shard only moves prefixes onto it; removing one only moves its own.
+void testHashRingMovesFewPrefixes() {
+    HashRing three = parsedRing("alpha,beta,gamma"), four = parsedRing("alpha,beta,gamma,delta"),
+             two = parsedRing("alpha,gamma");
+    size_t moved = 0;
+    for (uint32_t prefix = 0; prefix < RANGE_PREFIXES; prefix++) {
+        const string& before = three.name(three.ownerOf(prefix));
+        const string& added = four.name(four.ownerOf(prefix));
+        if (added != before) {
+            CHECK(added == "delta");
+            moved++;
+        }
+        if (before != "beta") CHECK(two.name(two.ownerOf(prefix)) == before);
+    }
+    CHECK(moved > RANGE_PREFIXES / 8 && moved < RANGE_PREFIXES / 2);
+}
+
+// A shard's range table holds exactly the hashes whose prefix it owns.
+void testShardRangeTable() {
+    HashRing ring = parsedRing("alpha,beta,gamma");
+    vector<string> passwords;
+    mt19937 rng(41);
+    for (int i = 0; i < 3000; i++) passwords.push_back(randomText(rng, 10, "abcdefghijklmnopqrstuvwxyz"));
+    for (size_t shard = 0; shard < ring.size(); shard++) {
+        RangeTable table;
+        CHECK(builtRangeTable(passwords, table, &ring, shard));
+        CHECK(table.shardId() == ring.shardId(shard));
+        for (const string& password : passwords) {
+            bool owned = ring.ownerOf(rangePrefix(sha1(password).bytes)) == shard;
+            CHECK((table.count(sha1(password)) > 0) == owned);
+        }
+    }
+}
+
+/* =====================================================
+   MATCH ENGINES
+   --engine per-pattern must report what the automaton
+   does, so the CLI comparison measures speed alone.
+   ===================================================== */
+
+// The engine is a process-wide setting, read both when building and when analyzing.
+struct EngineScope {
+    MatchEngine saved = g_matchEngine;
+    explicit EngineScope(MatchEngine engine) { g_matchEngine = engine; }
+    ~EngineScope() { g_matchEngine = saved; }
+};
+
+shared_ptr<const PatternIndex> indexWithEngine(const string& path, MatchEngine engine) {
+    EngineScope scope(engine);
+    return buildPatternIndex(path, nullptr, nullptr);
+}
+
+AnalysisResult analyzedWith(const string& password, const PatternIndex& index, MatchEngine engine) {
+    EngineScope scope(engine);
+    AnalysisResult result;
+    analyzePassword(password, index, result);
+    return result;
+}
+
+bool sameAnalysis(const AnalysisResult& a, const AnalysisResult& b) {
+    if (a.score != b.score || a.strength != b.strength || a.suggestions != b.suggestions ||
+        a.matchCount != b.matchCount)
+        return false;
+    for (size_t i = 0; i < min(a.matchCount, MAX_REPORTED_MATCHES); i++)
+        if (a.matches[i].patternId != b.matches[i].patternId || a.matches[i].start != b.matches[i].start ||
+            a.matches[i].length != b.matches[i].length)
+            return false;
+    return true;
+}
+
+// Lists with duplicates and a pattern over 255 bytes, and texts with more matches than are kept.
+void testEnginesReportTheSameMatches() {
+    mt19937 rng(41);
+    string path = testFilePath("engines.txt");
+    for (int list = 0; list < 50; list++) {
+        vector<string> words;
+        for (size_t n = 2 + rng() % 10; words.size() < n;) words.push_back(randomText(rng, 1 + rng() % 4, "ab1"));
+        words.push_back(words[rng() % words.size()]);
+        words.push_back(string(256 + rng() % 50, 'a'));
+        {
+            ofstream out(path, ios::binary);
+            for (const string& w : words) out << w << '\n';
+        }
+        shared_ptr<const PatternIndex> ac = indexWithEngine(path, MatchEngine::AhoCorasick);
+        shared_ptr<const PatternIndex> perPattern = indexWithEngine(path, MatchEngine::PerPattern);
+        CHECK(ac && perPattern);
+        if (!ac || !perPattern) continue;
+        CHECK(ac->skippedPatterns == 1 && perPattern->skippedPatterns == 1);
+        for (int t = 0; t < 20; t++) {
+            string text = randomText(rng, rng() % 40, "ab1c");
+            if (t == 0) text = string(300, 'a');
+            CHECK(sameAnalysis(analyzedWith(text, *ac, MatchEngine::AhoCorasick),
+                               analyzedWith(text, *perPattern, MatchEngine::PerPattern)));
+        }
+    }
+    remove(path.c_str());
+}
+
+/* =====================================================
+   RESULT CACHE
+   ===================================================== */
+
+// A hit must give back everything a response reports of the fresh analysis.
+void checkSameResponse(const AnalysisResult& hit, const AnalysisResult& fresh) {
+    CHECK(hit.strength == fresh.strength);
+    CHECK(hit.score == fresh.score);
+    CHECK(hit.log10Guesses == fresh.log10Guesses);
+    CHECK(hit.breached == fresh.breached);
+    CHECK(hit.suggestions == fresh.suggestions);
+    CHECK(hit.matchCount == fresh.matchCount);
+    for (size_t i = 0; i < min(hit.matchCount, MAX_REPORTED_MATCHES); i++) {
+        CHECK(hit.matches[i].start == fresh.matches[i].start);
+        CHECK(hit.matches[i].length == fresh.matches[i].length);
+        CHECK((hit.matches[i].patternId < 0) == (fresh.matches[i].patternId < 0));
+    }
+}
+
+vector<string> cachePasswords() {
+    vector<string> passwords = {"", "a", "password", "Password1!", "qwerty123", "aaaaaaa", "xK9#mQ2$vL7!",
+                                "correcthorsebatterystaple", "P@ssw0rd2024", string(300, 'z')};
+    mt19937 rng(5);
+    const char* alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGH0123456789!@#$";
+    for (int i = 0; i < 300; i++) {
+        string s(1 + rng() % 24, ' ');
+        for (char& c : s) c = alphabet[rng() % strlen(alphabet)];
+        passwords.push_back(s);
+    }
+    return passwords;
+}
+
+void testCacheHitsMatchRecompute() {
+    ResultCache cache(1 << 20);
+    uint64_t generation = testIndex().generation;
+    for (const string& password : cachePasswords()) {
+        AnalysisResult fresh = analyzed(password), hit;
+        if (cache.lookup(password, generation, hit)) continue;      // a duplicate in the list
+        cache.store(password, generation, fresh);
+        if (fresh.matchCount > CACHED_MATCHES) continue;             // never cached
+        CHECK(cache.lookup(password, generation, hit));
+        checkSameResponse(hit, fresh);
+        CHECK(!cache.lookup(password, generation + 1, hit));        // a reload's entries are separate
+    }
+}
+
+// A cache far smaller than its working set keeps evicting, and every hit is still right.
+void testCacheEvictionKeepsHitsRight() {
+    ResultCache cache(1);       // one slot per shard
+    uint64_t generation = testIndex().generation;
+    vector<string> passwords = cachePasswords();
+    mt19937 rng(9);
+    for (int i = 0; i < 20000; i++) {
+        const string& password = passwords[rng() % passwords.size()];
+        AnalysisResult hit;
+        if (cache.lookup(password, generation, hit)) checkSameResponse(hit, analyzed(password));
+        else cache.store(password, generation, analyzed(password));
+    }
+    CacheStats stats = cache.stats();
+    CHECK(stats.hits > 0);
+    CHECK(stats.entries <= stats.capacity);
+}
+
+void testCachedAnalysisMatchesUncached() {
+    g_resultCache = make_unique<ResultCache>(1 << 20);
+    for (const string& password : cachePasswords())
+        for (int pass = 0; pass < 2; pass++) {      // a miss, then a hit
+            AnalysisResult cached;
+            analyzePasswordCached(password, testIndex(), cached);
+            checkSameResponse(cached, analyzed(password));
+        }
+    g_resultCache.reset();
+}
+
+/* =====================================================
+   INDEX PUBLICATION
+   A published snapshot is freed only after every reader
+   that could have loaded it has left.
+   ===================================================== */
+
+atomic<int> g_freedIndexes{0};
+
+// A fresh index that counts itself in g_freedIndexes when the publisher lets it go.
+shared_ptr<const PatternIndex> countedIndex() {
+    shared_ptr<const PatternIndex> built = buildPatternIndex(WEAK_PATTERN_FILE, nullptr, nullptr);
+    const PatternIndex* raw = built.get();
+    return shared_ptr<const PatternIndex>(raw, [built](const PatternIndex*) mutable {
+        built.reset();
+        g_freedIndexes++;
+    });
+}
+
+void testPublishWaitsForReaders() {
+    publishPatternIndex(countedIndex());
+    int freedBefore = g_freedIndexes;
+    atomic<bool> published{false};
+    thread publisher;
+    uint64_t oldGeneration;
+    {
+        auto reader = currentPatternIndex();
+        oldGeneration = reader->generation;
+        publisher = thread([&] {
+            publishPatternIndex(countedIndex());
+            published = true;
+        });
+        // New readers see the new snapshot at once; the old one waits for this reader
+        for (int i = 0; i < 1000 && currentPatternIndex()->generation == oldGeneration; i++)
+            this_thread::sleep_for(chrono::milliseconds(1));
+        CHECK(currentPatternIndex()->generation != oldGeneration);
+        this_thread::sleep_for(chrono::milliseconds(20));
+        CHECK(!published);
+        CHECK(g_freedIndexes == freedBefore);
+        CHECK(reader->generation == oldGeneration);
+    }
+    publisher.join();
+    CHECK(published);
+    CHECK(g_freedIndexes == freedBefore + 1);
+}
+
+// Readers analyzing against whatever is current while snapshots are swapped under them.
+void testReadersDuringRepublish() {
+    const int PUBLISHES = 20;
+    publishPatternIndex(countedIndex());
+    int freedBefore = g_freedIndexes;
+    atomic<bool> stop{false};
+    atomic<int> failures{0};
+    atomic<uint64_t> reads{0};
+    vector<thread> readers;
+    for (int t = 0; t < 3; t++)
+        readers.emplace_back([&] {
+            AnalysisResult result;
+            while (!stop) {
+                auto index = currentPatternIndex();
+                uint64_t generation = index->generation;
+                analyzePassword("password123", *index, result);
+                if (index->generation != generation || !result.matchCount) failures++;
+                reads++;
+            }
+        });
+    for (int i = 0; i < PUBLISHES; i++) {
+        // Let the readers get going on the current snapshot before replacing it
+        for (uint64_t seen = reads; reads < seen + 50;) this_thread::yield();
+        publishPatternIndex(countedIndex());
+    }
+    stop = true;
+    for (thread& t : readers) t.join();
+    CHECK(failures == 0);
+    CHECK(g_freedIndexes == freedBefore + PUBLISHES);
+    publishPatternIndex(buildPatternIndex(WEAK_PATTERN_FILE, nullptr, nullptr));
+    CHECK(g_freedIndexes == freedBefore + PUBLISHES + 1);
+}
+
+/* =====================================================
+   BINARY FRAMES
+   ===================================================== */
+
+string requestFrame(const vector<string>& passwords) {
+    string body(FRAME_REQUEST_MAGIC, 4);
+    body.resize(FRAME_HEADER_SIZE);
+    writeLE(&body[4], (uint32_t)passwords.size(), 4);
+    for (const string& password : passwords) {
+        char length[2];
+        writeLE(length, (uint32_t)password.size(), 2);
+        body.append(length, 2);
+        body += password;
+    }
+    return body;
+}
+
+// The error parseFrame gives for body, or "" if it accepts it.
+string frameError(const string& body) {
+    vector<string_view> passwords;
+    string error;
+    return parseFrame(body, passwords, error) ? "" : error;
+}
+
+void testFrameRoundTrip() {
+    vector<string> passwords = {"", "password", string("a\0b\xff", 4), string(UINT16_MAX, 'x')};
+    string body = requestFrame(passwords);
+    vector<string_view> parsed;
+    string error;
+    CHECK(parseFrame(body, parsed, error));
+    CHECK(parsed.size() == passwords.size());
+    for (size_t i = 0; i < min(parsed.size(), passwords.size()); i++) CHECK(parsed[i] == passwords[i]);
+    CHECK(frameError(requestFrame({})) == "");
+}
+
+void testMalformedFramesAreRejected() {
+    string header(FRAME_REQUEST_MAGIC, 4);
+    CHECK(frameError("") == "expected a PWQ1 frame");
+    CHECK(frameError(header) == "expected a PWQ1 frame");
+    CHECK(frameError("PWQ2" + requestFrame({}).substr(4)) == "expected a PWQ1 frame");
+
+    string tooMany = requestFrame({});
+    writeLE(&tooMany[4], (uint32_t)MAX_BATCH_SIZE + 1, 4);
+    CHECK(frameError(tooMany) == "too many passwords");
+
+    string shortOfCount = requestFrame({"ab"});
+    writeLE(&shortOfCount[4], 3, 4);
+    CHECK(frameError(shortOfCount) == "frame shorter than its count");
+
+    string truncatedLength = requestFrame({"a", ""});
+    truncatedLength.pop_back();
+    CHECK(frameError(truncatedLength) == "truncated length at entry 1");
+
+    string truncatedPassword = requestFrame({"abcdef"});
+    truncatedPassword.pop_back();
+    CHECK(frameError(truncatedPassword) == "truncated password at entry 0");
+
+    CHECK(frameError(requestFrame({"abc"}) + "x") == "trailing data after frame");
+
+    // Every cut of a valid frame is rejected
+    string valid = requestFrame({"one", "", "three", string(300, 'p')});
+    for (size_t cut = 0; cut < valid.size(); cut++) CHECK(frameError(valid.substr(0, cut)) != "");
+}
+
+// Corrupted frames are rejected or give views that exactly tile the body.
+void testCorruptFramesStayInBounds() {
+    mt19937 rng(3);
+    string valid = requestFrame({"alpha", "", "bravo!", string(40, 'c'), "d"});
+    for (int trial = 0; trial < 20000; trial++) {
+        string body = valid;
+        for (int flips = 1 + rng() % 3; flips > 0; flips--) body[rng() % body.size()] = (char)rng();
+        vector<string_view> parsed;
+        string error;
+        if (!parseFrame(body, parsed, error)) continue;
+        size_t covered = FRAME_HEADER_SIZE;
+        for (string_view p : parsed) {
+            CHECK(p.data() >= body.data() && p.data() + p.size() <= body.data() + body.size());
+            covered += 2 + p.size();
+        }
+        CHECK(covered == body.size());
+    }
+}
+
+/* =====================================================
+   SERVER SETTINGS
+   ===================================================== */
+
+void testParseCount() {
+    size_t n = 7;
+    CHECK(parseCount("0", n) && n == 0);
+    CHECK(parseCount("42", n) && n == 42);
+    CHECK(parseCount(to_string(SIZE_MAX), n) && n == SIZE_MAX);
+    for (const char* bad : {"", "-1", " -1", " 1", "1 ", "+1", "0x10", "1e3", "12abc", "99999999999999999999999"}) {
+        n = 7;
+        CHECK(!parseCount(bad, n));
+        CHECK(n == 7);
+    }
+}
+
+void testServerSettings() {
+    ServerConfig config;
+    CHECK(applyServerSetting(config, "port", "8080") && config.port == 8080);
+    CHECK(!applyServerSetting(config, "port", "0"));
+    CHECK(!applyServerSetting(config, "port", "65536"));
+    CHECK(config.port == 8080);
+    CHECK(!applyServerSetting(config, "workers", "0"));
+    CHECK(applyServerSetting(config, "workers", "4") && config.workers == 4);
+    CHECK(applyServerSetting(config, "pin-threads", "yes") && config.pinThreads);
+    CHECK(!applyServerSetting(config, "pin-threads", "maybe"));
+    CHECK(!applyServerSetting(config, "read-timeout", "-5"));
+    CHECK(applyServerSetting(config, "max-queue", "100") && config.maxQueue == 100);
+    CHECK(!applyServerSetting(config, "host", ""));
+    CHECK(applyServerSetting(config, "admin-token", "secret") && config.adminToken == "secret");
+    CHECK(!applyServerSetting(config, "no-such-setting", "1"));
+}
+
+void testConfigFile() {
+    string path = (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") + string("/pw_tests.conf");
+    auto load = [&](const string& text, ServerConfig& config, string& error) {
+        ofstream(path, ios::trunc) << text;
+        return loadServerConfig(config, path, error);
+    };
+    ServerConfig config;
+    string error;
+    CHECK(load("# comment\n  port = 9000  # trailing\n\nworkers=3\r\nreactor = true\nport = 9001\n", config, error));
+    CHECK(config.port == 9001 && config.workers == 3 && config.reactor);
+
+    CHECK(!load("port = 9000\nworkers = many\n", config, error));
+    CHECK(error == path + ":2: invalid setting 'workers = many'");
+    CHECK(!load("port 9000\n", config, error));
+    CHECK(error.find(":1: invalid setting") != string::npos);
+    remove(path.c_str());
+    CHECK(!loadServerConfig(config, path, error));
+    CHECK(error == "cannot open " + path);
+}
+
+int main() {
+    testLongRepeatsStayWeak();
+    testLongPasswordsKeepTheirStrength();
+    testProfileKernelsMatchScalar();
+    testProfileTriplesMatchScanRuns();
+    testScanRunsFindsEachKind();
+    testScanRunsEdges();
+    testScanRunsLongestRepeat();
+    testTrieScanMatchesBruteForce();
+    testTrieLimits();
+    testStaticAutomataMatchBruteForce();
+    testJsonEscaping();
+    testJsonLayout();
+    testSha1();
+    testRangeTableCounts();
+    testHashRingParse();
+    testHashRingOwnersAreStable();
+    testHashRingMovesFewPrefixes();
+    testShardRangeTable();
+    testEnginesReportTheSameMatches();
+    testCacheHitsMatchRecompute();
+    testCacheEvictionKeepsHitsRight();
+    testCachedAnalysisMatchesUncached();
+    testPublishWaitsForReaders();
+    testReadersDuringRepublish();
+    testFrameRoundTrip();
+    testMalformedFramesAreRejected();
+    testCorruptFramesStayInBounds();
+    testParseCount();
+    testServerSettings();
+    testConfigFile();
+    if (g_failures) {
+        cerr << g_failures << " checks failed\n";
+        return 1;
+    }
+    cout << "All checks passed\n";
+    return 0;
+}
@@ -0,0 +1,53 @@
+/* =====================================================
+   WEBASSEMBLY BUILD
+   The engine in analyzer.h compiled for the browser, so
+   the page's instant estimate is the server's analysis:
+   same rules, same scores, same suggestion text. Only
+   the dictionary and breach checks stay on the server,
+   since they need its index files. Build with
+   Emscripten next to index.html, which loads it when
+   present and falls back to its JavaScript estimate:
+
+     em++ -O2 -std=c++17 wasm.cpp -o analyzer.js \
+          -sMODULARIZE -sEXPORT_NAME=createAnalyzer \
+          -sEXPORTED_RUNTIME_METHODS=ccall
+
+   pw_analyze returns the same JSON as POST /analyze;
+   pw_last_suggestions returns the Suggestion bits of
+   that result, which the page turns into its rule list.
+   ===================================================== */
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#define PW_EXPORT extern "C" EMSCRIPTEN_KEEPALIVE
+#else
+#define PW_EXPORT extern "C"
+#endif
+
+#include "analyzer.h"
+
+// There is no weak_patterns.txt in the browser, so this is the built-in list.
+const PatternIndex& browserIndex() {
+    static shared_ptr<const PatternIndex> index = buildPatternIndex(WEAK_PATTERN_FILE, nullptr, nullptr);
+    return *index;
+}
+
+// The module is single-threaded; results stay valid until the next call.
+AnalysisResult g_lastResult;
+string g_lastJson;
+
+PW_EXPORT const char* pw_analyze(const char* password) {
+    analyzePassword(password, browserIndex(), g_lastResult);
+    g_lastJson.clear();
+    appendResultJson(g_lastJson, g_lastResult);
+    return g_lastJson.c_str();
+}
+
+PW_EXPORT uint32_t pw_last_suggestions() { return g_lastResult.suggestions; }
+
+#ifndef __EMSCRIPTEN__
+// A native build reads passwords from stdin, for comparing against the server.
+int main() {
+    for (string line; getline(cin, line);) cout << pw_analyze(line.c_str()) << "\n";
+    return 0;
+}
+#endif